@@ -1,13 +1,27 @@
 /* Pipeline Cache Simulator  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "iplc-stats.h"
 
 /* compatibility macro */
 #define bzero(p,len) (memset((p), '\0', (len)), (void *) 0)
 
+/* Statistics groups built in; the rest are never counted */
+#ifndef STATS_COMPILED
+#define STATS_COMPILED (~0u)
+#endif
+#define STAT_ON(group) ((STATS_COMPILED & (group)) && (stat_enabled & (group)))
+
 /* constants that affect cache size,
  * how "long" cache miss delay is,
  * and how many stages are in our pipeline.
@@ -15,7 +29,22 @@
 enum {
 	MAX_CACHE_SIZE = 10240,
 	CACHE_MISS_DELAY = 10, // 10 cycle cache miss penalty
-	MAX_STAGES = 5
+	MAX_STAGES = 5,
+	BRANCH_PENALTY = 1, // extra cycles a mispredicted branch costs
+	MAX_LEVELS = 4, // the cache plus up to three levels below it
+	MAX_REGIONS = 16, // address ranges that bypass the cache
+	MAX_LOCKS = 16, // address ranges locked into the cache
+	BLOCK_MAX = 64, // longest basic block whose timing is remembered
+	HIST_SUB_BITS = 3, // a latency histogram splits each power of two eight ways
+	HIST_BUCKETS = (32 - HIST_SUB_BITS + 1) << HIST_SUB_BITS,
+	STATS_PERIOD = 1 << 16, // instructions between updates of the live statistics page
+	SIM_VERSION = 1, // bump whenever the same configuration would simulate differently
+	RESULT_KEY = 4096, // bytes of a result cache key, with every region, lock and level
+	RAW_PC = 4, // instruction address given to accesses of traces that have none
+	PAGE_MIN = 256, // smallest page -P takes, so the frames of memory stay countable
+	PAGE_DRAWS = 64, // random frames tried before taking the next free one
+	TRACE_HEAD = 256, // bytes of a trace looked at to tell its format
+	HOST_LINE = 64 // host cache line; arena allocations are aligned to it
 };
 
 typedef unsigned int uint;
@@ -23,31 +52,191 @@ typedef unsigned char byte;
 
 /* init the simulator */
 void iplc_sim_init(int index, int blocksize, int assoc);
+void iplc_sim_free();
+
+/* Arena allocation */
+struct arena;
+size_t iplc_sim_arena_round(size_t size);
+void iplc_sim_arena_reserve(struct arena *a, size_t size);
+void *iplc_sim_arena_alloc(struct arena *a, size_t size);
+void iplc_sim_arena_free(struct arena *a);
 
 /* Cache simulator functions */
-void iplc_sim_LRU_replace_on_miss(int index, int tag, int assoc_entry);
-void iplc_sim_LRU_update_on_hit(int index, int assoc_entry);
-int iplc_sim_trap_address(uint address);
+struct cache;
+unsigned long iplc_sim_cache_size(int sets, int blocksize, int assoc);
+size_t iplc_sim_cache_bytes(int sets, int assoc);
+void iplc_sim_cache_init(struct cache *c, struct arena *a, int sets, int blocksize, int assoc);
+int iplc_sim_cache_lookup(struct cache *c, uint address, int write);
+int iplc_sim_cache_refetch(struct cache *c, uint address);
+int iplc_sim_cache_probe(struct cache *c, uint address);
+int iplc_sim_cache_set(struct cache *c, uint address);
+int iplc_sim_parse_sets(char *s, int *sets);
+void iplc_sim_cache_flush(struct cache *c, double fraction);
+void iplc_sim_LRU_replace_on_miss(struct cache *c, int index, int assoc_entry, uint tag);
+void iplc_sim_LRU_update_on_hit(struct cache *c, int index, int assoc_entry);
+int iplc_sim_trap_address(uint address, int size, int type, uint pc, int *latency);
+int iplc_sim_crosses_block(struct cache *c, uint address, int size);
+
+/* Cache locking */
+int iplc_sim_parse_lock(char *s);
+void iplc_sim_lock_range(uint base, uint size, int lock);
+void iplc_sim_lock_init();
+void iplc_sim_lock_marker(uint pc);
+void iplc_sim_lock_finalize();
+
+/* Lower hierarchy and miss streams */
+size_t iplc_sim_lower_bytes();
+void iplc_sim_lower_init(struct arena *a);
+int iplc_sim_lower_access(int level, uint address, int type, uint asid);
+void iplc_sim_lower_finalize();
+int iplc_sim_parse_fill(char *s);
+int iplc_sim_fill_latency(uint address, int hit, int latency);
+int iplc_sim_parse_region(char *s);
+struct region *iplc_sim_region_find(uint address);
+void iplc_sim_region_finalize();
+void iplc_sim_miss_stream_open(char *path);
+void iplc_sim_miss_stream_record(int type, uint address, uint pc);
+void iplc_sim_miss_stream_replay(char *path);
+
+/* Address translation */
+int iplc_sim_parse_page_policy(char *s);
+void iplc_sim_page_init();
+uint iplc_sim_translate(uint asid, uint address);
+void iplc_sim_page_finalize();
 
 /* Pipeline functions */
+struct insn;
 uint iplc_sim_parse_reg(byte *reg_str);
+int iplc_sim_access_size(byte *instruction);
 void iplc_sim_parse_instruction(byte *buffer);
+void iplc_sim_decode_instruction(byte *buffer, struct insn *insn);
+void iplc_sim_issue_instruction(struct insn *insn);
+long iplc_sim_issue_steady(struct insn *trace, long count);
+long iplc_sim_issue_block(struct insn *trace, long count);
+long iplc_sim_issue_batch(struct insn *trace, long count, long *simple);
 void iplc_sim_push_pipeline_stage();
 void iplc_sim_process_pipeline_rtype(byte *instruction, int dest_reg,
 									 int reg1, int reg2_or_constant);
-void iplc_sim_process_pipeline_lw(int dest_reg, int base_reg, uint data_address);
-void iplc_sim_process_pipeline_sw(int src_reg, int base_reg, uint data_address);
+void iplc_sim_process_pipeline_lw(int dest_reg, int base_reg, uint data_address, int size);
+void iplc_sim_process_pipeline_sw(int src_reg, int base_reg, uint data_address, int size);
 void iplc_sim_process_pipeline_branch(int reg1, int reg2);
 void iplc_sim_process_pipeline_jump();
 void iplc_sim_process_pipeline_syscall();
 void iplc_sim_process_pipeline_nop();
 
+/* Pipeline timeline */
+void iplc_sim_timeline_open(char *path, long first, long count);
+void iplc_sim_timeline_push(int cycles, char *cause);
+void iplc_sim_timeline_issue(int instruction_hit);
+void iplc_sim_timeline_close();
+
+/* Trace readers */
+struct trace_reader;
+struct trace_in;
+struct trace_reader *iplc_sim_trace_reader(char *name);
+struct trace_in *iplc_sim_trace_open(char *path);
+int iplc_sim_trace_read(struct trace_in *in, struct insn *insn);
+void iplc_sim_trace_close(struct trace_in *in);
+
+/* Whole-trace functions */
+struct insn *iplc_sim_load_trace(struct trace_in *in, long *count);
+void iplc_sim_run(struct insn *trace, long count);
+void iplc_sim_drain();
+
 /* Outout performance results */
 void iplc_sim_finalize();
 
+/* Statistics registry */
+struct statistic;
+struct sim_result;
+int iplc_sim_stat_parse_groups(char *s);
+struct statistic *iplc_sim_stat_find(char *name);
+long iplc_sim_stat_value(struct statistic *st, int i);
+int iplc_sim_stat_length(struct statistic *st);
+double iplc_sim_stat_of(char *name, struct sim_result *r);
+void iplc_sim_stat_print(int section, int element, struct sim_result *r);
+void iplc_sim_stat_dump(char *path);
+
+/* Live statistics */
+void iplc_sim_stats_open(char *path);
+void iplc_sim_stats_publish(int done);
+
+/* Latency histograms */
+struct hist;
+void iplc_sim_hist_add(struct hist *h, uint v);
+uint iplc_sim_hist_percentile(struct hist *h, double p);
+void iplc_sim_latency_finalize();
+
+/* Outcome streams */
+void iplc_sim_outcomes_open(char *path);
+void iplc_sim_outcome_push(int branch, int data);
+void iplc_sim_outcome_fetch();
+void iplc_sim_outcomes_close();
+void iplc_sim_outcomes_replay(char *path, char **variants, int nvariants);
+
+/* Result cache */
+struct sim_result;
+struct sweep_sample;
+unsigned long long iplc_sim_trace_hash(struct insn *trace, long count);
+void iplc_sim_result_key(char *key, int n, unsigned long long hash, long count,
+						 int index, int blocksize, int assoc, long window);
+void iplc_sim_result_collect(struct sim_result *r);
+void iplc_sim_results_open(char *path);
+struct result_entry *iplc_sim_results_find(char *key);
+void iplc_sim_results_store(char *key, struct sim_result *r,
+							struct sweep_sample *win, long nwin);
+
+/* Design space search */
+struct range;
+int iplc_sim_parse_range(char *s, struct range *r);
+void iplc_sim_stack_distance(struct insn *trace, long count, int index, int blocksize,
+							 int depth, long *imiss, long *dmiss);
+void iplc_sim_tune(struct insn *trace, long count, unsigned long budget);
+
+/* What-if sensitivity */
+void iplc_sim_whatif(struct insn *trace, long count, int index, int blocksize, int assoc);
+
+/* Differential simulation */
+int iplc_sim_parse_policy(char *s);
+size_t iplc_sim_diff_bytes(int sets);
+void iplc_sim_diff_init(struct arena *a);
+void iplc_sim_diff_access(uint address, uint pc, int hit);
+void iplc_sim_diff_finalize();
+
+/* Multiprogrammed workloads */
+void iplc_sim_mix(struct insn **traces, long *counts, char **names, int nprogs,
+				  int index, int blocksize, int assoc);
+
+/* Time-sliced runs */
+void iplc_sim_warm(struct insn *trace, long count);
+void iplc_sim_slices(struct insn *trace, long count, int index, int blocksize, int assoc);
+
+/* Early-terminating sweeps */
+double iplc_sim_confidence_z(double confidence);
+void iplc_sim_sweep(struct insn *trace, long count, unsigned long budget, int use_cpi);
+
+/* Trace stripping */
+void iplc_sim_strip(struct insn *trace, long count, int index, int blocksize, char *path);
+void iplc_sim_strip_replay(FILE *f, byte *hdr, char *path);
+
+/*
+ * All simulator state that is sized by the configuration lives in one
+ * arena: a single host-line-aligned block carved up by bumping used.
+ * Nothing in it is freed on its own; the whole block goes at once.
+ */
+typedef struct arena{
+	byte *base;
+	size_t size;
+	size_t used;
+} arena_t;
+
+arena_t arena;
+
 typedef struct cache_line{
 	int valid; /* the valid bit */
 	uint tag;  /* the tag */
+	uint asid; /* address space the tag belongs to */
+	int dirty; /* written since it was filled */
 	/* the tree structure, which provides associativity */
 	struct cache_line *lru_prev, *lru_next; 
 } cache_line_t;
@@ -55,16 +244,150 @@ typedef struct cache_line{
 /* When cache set is full (all valid bits in lines are set), dump tail from cache */
 typedef struct cache_set{
 	cache_line_t *lines, *lru_head, *lru_tail;
+	int locked;     /* lines[0 .. locked) are pinned, outside the LRU order */
 } cache_set_t;
 
-cache_set_t *cache=NULL;
-int cache_index=0;
-int cache_blocksize=0;
-int cache_blockoffsetbits = 0;
-int cache_assoc=0;
-long cache_miss=0;
-long cache_access=0;
-long cache_hit=0;
+enum replacement_policy {REPLACE_LRU, REPLACE_FIFO};
+
+/* One cache: its geometry, its sets, and its counters */
+typedef struct cache{
+	cache_set_t *sets;
+	int index;           /* index bits; for a count of sets not a power of two, those a set number takes */
+	uint nsets;
+	long capacity;       /* bytes of data */
+	unsigned long long setmul;   /* 2^64 / nsets rounded up, for nsets not a power of two; else 0 */
+	int blocksize;       /* words per block */
+	int blockoffsetbits;
+	int assoc;
+	int policy;          /* enum replacement_policy */
+	uint asid;           /* address space of the program now running */
+	long miss;
+	long access;
+	long hit;
+	long writebacks;
+	long locked;         /* lines pinned */
+	long lock_hits;      /* hits on pinned lines */
+	uint victim;         /* block the last lookup evicted dirty, */
+	uint victim_asid;    /* whose it was, */
+	int victim_dirty;    /* if it did */
+	struct cache_line *last_line;   /* the line the last lookup hit or filled */
+	struct cache_line *fetch_line;  /* the line of the last instruction fetch, */
+	uint fetch_block;               /* and its block address */
+} cache_t;
+
+/* The kinds of access a cache sees */
+enum access_type {ACCESS_IFETCH, ACCESS_LOAD, ACCESS_STORE, ACCESS_WRITEBACK};
+
+cache_t cache;
+int l1_sets = 0;                    /* the cache's sets, when given as a count; 0: 1 << index */
+/* Geometry and hit latency of one level below the cache */
+typedef struct level_config{
+	int index;
+	int sets;           /* 1 << index, unless given as a count */
+	int blocksize;
+	int assoc;
+	int latency;
+} level_config_t;
+
+cache_t lower[MAX_LEVELS-1];        /* L2, L3, ... below cache */
+level_config_t lower_config[MAX_LEVELS-1];
+int nlower = 0;
+long memory_access = 0;             /* accesses that went all the way to memory */
+
+/* How a block missed in the cache is filled: whole, in order, or critical word first */
+enum fill_order {FILL_WHOLE, FILL_EARLY, FILL_CWF};
+
+/* The cache's block fill now or last under way, with beat timing on */
+typedef struct fill{
+	int valid;
+	uint block;         /* block address */
+	uint first;         /* cycle its first beat arrives */
+	int critical;       /* the beat that comes first */
+} fill_t;
+
+int beat_words = 0;                 /* words a beat of a fill brings; 0: fills take memory_latency */
+int beat_cycles = 1;                /* cycles between beats */
+int fill_order = FILL_CWF;
+fill_t fill;
+uint fill_bus_free = 0;             /* cycle the last fill's last beat arrives */
+
+/* What an address range that bypasses the cache is */
+enum region_kind {REGION_SCRATCH, REGION_UNCACHED};
+
+/* A range of addresses that bypasses the whole hierarchy */
+typedef struct region{
+	uint base;
+	uint size;
+	int latency;        /* cycles every access takes */
+	int kind;           /* enum region_kind */
+	long access;
+} region_t;
+
+region_t region[MAX_REGIONS];       /* sorted by base, none overlapping */
+int nregions = 0;
+
+/* A range of addresses to pin in the cache, from the start or between marker PCs */
+typedef struct cache_lock{
+	uint base;
+	uint size;
+	uint lock_pc;       /* fetching it locks the range; 0: locked from the start */
+	uint unlock_pc;     /* fetching it unlocks the range; 0: never */
+	int locked;
+} cache_lock_t;
+
+cache_lock_t locks[MAX_LOCKS];
+int nlocks = 0;
+int lock_markers = 0;               /* locks with a marker PC, which are looked for at every fetch */
+long lock_refused = 0;              /* blocks not locked, their set having one way left unlocked */
+
+/*
+ * What served an access, in an outcome stream: 0 for the cache, 1 on for
+ * the levels below it, then these
+ */
+enum outcome_code {OUTCOME_MEMORY = MAX_LEVELS, OUTCOME_FIXED, OUTCOME_NONE = 7};
+
+FILE *outcomes = NULL;              /* cache and branch outcomes of this run, if recording */
+long outcome_pushes = 0;            /* pushes of the run, with an event or not */
+long outcome_events = 0;
+int lower_served = 0;               /* the level below the cache that served the last miss */
+int trap_served = 0;                /* what served the last block trap_block looked up */
+int trap_code[2];                   /* what served the last trapped access: first block, slowest other, */
+int trap_fixed;                     /* and its latency, if OUTCOME_FIXED */
+
+iplc_stats_t *stats_page = NULL;    /* the live statistics page, if publishing */
+long stats_left = 0;                /* instructions until it is next updated */
+struct statistic *stats_slot[IPLC_STATS_ENTRIES];  /* what each entry of the page holds */
+int stats_element[IPLC_STATS_ENTRIES];             /* and which element of it */
+int memory_latency = CACHE_MISS_DELAY;
+FILE *miss_stream = NULL;           /* L1 misses and writebacks, if wanted */
+int strip_stream = 0;               /* it is a stripped trace: misses only, at their positions */
+long split_access = 0;   /* accesses that straddled blocks */
+int cache_policy = REPLACE_LRU;
+unsigned long max_cache_size = MAX_CACHE_SIZE;
+
+/* How virtual pages of the trace get physical frames */
+enum page_policy {PAGE_NONE, PAGE_SEQUENTIAL, PAGE_RANDOM, PAGE_BINHOP, PAGE_COLOR};
+
+/* One mapped page */
+typedef struct page{
+	uint asid;
+	uint vpn;
+	uint pfn;
+	int used;
+} page_t;
+
+int page_policy = PAGE_NONE;   /* PAGE_NONE: caches see trace addresses */
+uint page_size = 4096;         /* bytes, a power of two */
+int page_virtual_l1 = 0;       /* index and tag the cache with virtual addresses */
+int page_shift = 12;
+uint page_colors = 1;          /* frames a physically indexed way spans */
+page_t *pages = NULL;          /* open-addressed, pages_size a power of two */
+long pages_size = 0;
+long pages_used = 0;
+uint *page_next = NULL;        /* next frame of each color */
+uint page_frame = 0;           /* next frame, sequential; next color, bin hopping */
+byte *page_taken = NULL;       /* frames handed out, random */
+uint page_seed = 1;
 
 byte instruction[16];
 byte reg1[16];
@@ -72,6 +395,25 @@ byte reg2[16];
 byte offsetwithreg[16];
 uint data_address=0;
 uint instruction_address=0;
+/*
+ * Every statistic belongs to one group; a group left out of stat_enabled
+ * is neither reported nor, where counting it costs anything, counted.
+ */
+enum stat_group {
+	STATS_CORE = 1 << 0,
+	STATS_L1 = 1 << 1,
+	STATS_LOWER = 1 << 2,
+	STATS_PAGES = 1 << 3,
+	STATS_LATENCY = 1 << 4
+};
+
+/* Where in the summary a statistic is printed, if it is */
+enum stat_section {SECTION_NONE, SECTION_CACHE, SECTION_LOCK, SECTION_LOWER, SECTION_MEMORY,
+				   SECTION_REGION, SECTION_PAGES, SECTION_PIPELINE, SECTION_LATENCY};
+
+uint stat_enabled = ~0u;
+char *stat_json = NULL;        /* where to dump them all at the end, if anywhere */
+
 uint pipeline_cycles=0;   /* how many cycles did you pipeline consume */
 uint instruction_count=0; /* home many real instructions ran thru the pipeline */
 uint branch_predict_taken=0;
@@ -80,6 +422,7 @@ uint correct_branch_predictions=0;
 
 uint debug=0;
 uint dump_pipeline=1;
+uint verbose=1;   /* per-access and per-cycle chatter; off for sweeps */
 
 typedef struct rtype{
 	byte instruction[16];
@@ -92,12 +435,14 @@ typedef struct load_word{
 	uint data_address;
 	int dest_reg;
 	int base_reg;
+	int size;  /* bytes accessed */
 } lw_t;
 
 typedef struct store_word{
 	uint data_address;
 	int src_reg;
 	int base_reg;
+	int size;  /* bytes accessed */
 } sw_t;
 
 typedef struct branch{
@@ -115,6 +460,7 @@ enum instruction_type {NOP, RTYPE, LW, SW, BRANCH, JUMP, JAL, SYSCALL};
 typedef struct pipeline{
 	enum instruction_type itype;
 	uint instruction_address;
+	uint fetched;    /* pipeline_cycles when its fetch began */
 	union{
 		rtype_t   rtype;
 		lw_t	  lw;
@@ -128,105 +474,501 @@ enum pipeline_stages {FETCH, DECODE, ALU, MEM, WRITEBACK};
 
 pipeline_t pipeline[MAX_STAGES];
 
+FILE *timeline = NULL;         /* Chrome trace-event JSON of a window of the run, if wanted */
+long timeline_first = 0;       /* the window: instructions issued before it, */
+long timeline_count = 10000;   /* and in it */
+long timeline_issued = 0;      /* instructions issued so far */
+long timeline_seq[MAX_STAGES]; /* which of them each stage holds, -1 for none */
+uint timeline_pushed = 0;      /* pipeline_cycles at the end of the last push, */
+uint timeline_push_began = 0;  /* and at its start */
+int timeline_events = 0;
+
+/* The timing of one basic block, entered with the pipeline in one state */
+typedef struct block_memo{
+	uint pc;                     /* where the block starts */
+	int n;                       /* instructions in it */
+	int itype[MAX_STAGES];       /* the pipeline it was entered with */
+	uint address[MAX_STAGES];
+	int used;
+	uint cycles;                 /* what issuing it added, every access hitting */
+	uint retired;
+	uint branches;
+	uint correct;
+	unsigned long long access;   /* bit k: the push issuing instruction k accesses data */
+	byte at[BLOCK_MAX];          /* cycles into the block when instruction k was issued */
+} block_memo_t;
+
+int block_memoize = 0;               /* replay the timing of basic blocks seen before */
+block_memo_t *block_memos = NULL;   /* open-addressed, block_memos_size a power of two */
+long block_memos_size = 0;
+long block_memos_used = 0;
+
+/*
+ * Counts of latencies in log-spaced buckets: exact below 1<<HIST_SUB_BITS,
+ * then each power of two split into 1<<HIST_SUB_BITS equal parts.
+ */
+typedef struct hist{
+	long count[HIST_BUCKETS];
+	uint max;
+} hist_t;
+
+hist_t retire_latency;         /* from fetch to retirement, per instruction */
+hist_t miss_latency;           /* to service, per cache miss */
+int show_latency = 0;          /* report their percentiles */
+
+/* One decoded line of the trace, ready to be issued to the pipeline */
+typedef struct insn{
+	enum instruction_type itype;
+	uint instruction_address;
+	uint data_address;
+	int size;        /* bytes the load or store accesses */
+	int dest_reg;
+	int reg1;
+	int reg2_or_constant;
+	int nofetch;     /* a data access only; nothing is fetched for it */
+	byte instruction[16];
+} insn_t;
+
+/* An open trace, and what its reader needs to keep between records */
+typedef struct trace_in{
+	FILE *f;
+	int pipe;                  /* f is a decompressor's output */
+	struct trace_reader *reader;
+	byte head[TRACE_HEAD];     /* the start of the trace, read to tell its format */
+	size_t nhead, pos;
+	byte line[80];
+	int held;                  /* line was put back, and is the next one */
+	uint pc;                   /* last instruction fetched */
+} trace_in_t;
+
+/* One trace format: how to recognise it and how to read a record of it */
+typedef struct trace_reader{
+	char *name;
+	int (*detect)(byte *head, size_t n);
+	int (*read)(trace_in_t *in, insn_t *insn);   /* 1 if it filled insn, 0 at the end */
+} trace_reader_t;
+
+trace_reader_t *trace_format = NULL;   /* given by -T; otherwise each trace's is detected */
+
+/* Loads and stores the parser knows, and how many bytes each accesses */
+struct memory_op{
+	char *name;
+	int size;
+} memory_ops[] = {
+	{"lw", 4}, {"lb", 1}, {"lbu", 1}, {"lh", 2}, {"lhu", 2}, {"ld", 8},
+	{"sw", 4}, {"sb", 1}, {"sh", 2}, {"sd", 8},
+};
+
+/* The full statistics of one completed simulation */
+typedef struct sim_result{
+	long cycles;
+	long instructions;
+	long branches;
+	long correct_branches;
+	long access;
+	long miss;
+	long hit;
+} sim_result_t;
+
+/* What a sweep worker reports at every window boundary */
+typedef struct sweep_sample{
+	long cycles;
+	long instructions;
+	long branches;
+	long correct_branches;
+	long access;
+	long miss;
+	int done;
+} sweep_sample_t;
+
+/* One stored result: the configuration it answers for, and the answer */
+typedef struct result_entry{
+	char *key;
+	sim_result_t r;
+	sweep_sample_t *win;   /* per-window samples, for sweep results */
+	long nwin;
+} result_entry_t;
+
+FILE *results_file = NULL;       /* appended to as results complete */
+result_entry_t *results = NULL;
+long nresults = 0;
+long results_cap = 0;
+
+/* An inclusive range of a configuration parameter, for searches */
+typedef struct range{
+	int lo;
+	int hi;
+} range_t;
+
+/* One configuration considered by iplc_sim_tune */
+typedef struct tune_point{
+	int index;
+	int blocksize;
+	int assoc;
+	unsigned long size;  /* bits, as iplc_sim_cache_size counts them */
+	double est_cpi;      /* from the stack-distance pass */
+	double cpi;          /* from full simulation, when simulated */
+	double miss_rate;
+	int simulated;
+} tune_point_t;
+
+/* How a parameter is moved either side of its base value by iplc_sim_whatif */
+enum whatif_kind {WHATIF_STEP, WHATIF_DOUBLE, WHATIF_FLIP};
+
+/* One parameter of the base configuration, and what moving it did */
+typedef struct whatif{
+	char name[16];
+	char *unit;
+	int *value;
+	int kind;             /* enum whatif_kind */
+	int min;
+	int tried[2];         /* the values below and above the base, */
+	int have[2];          /* if they could be simulated */
+	double cpi;           /* CPI change per unit */
+	double miss_rate;     /* miss rate change per unit */
+} whatif_t;
+
+range_t tune_index = {1, 12};
+range_t tune_blocksize = {1, 16};  /* powers of two within the range */
+range_t tune_assoc = {1, 16};      /* powers of two within the range */
+double tune_slack = 0.02;          /* keep estimates this close to the frontier */
+
+enum sweep_state {PENDING, RUNNING, DONE, PRUNED};
+
+/* One configuration of a sweep, as the coordinator sees it */
+typedef struct sweep_run{
+	int index;
+	int blocksize;
+	int assoc;
+	enum sweep_state state;
+	pid_t pid;
+	int fd;
+	double *x;      /* the metric for each window so far */
+	sweep_sample_t *win;  /* and the raw samples it came from */
+	int nwin;
+	int cached;     /* answered by the result cache */
+	long cycles;    /* totals over the windows so far */
+	long instructions;
+	long access;
+	long miss;
+} sweep_run_t;
+
+int sweep_workers = 0;          /* 0: one per online processor */
+long sweep_window = 4096;       /* instructions per window */
+int sweep_min_windows = 4;      /* windows in common before comparing two runs */
+double sweep_confidence = 0.99;
+
+/* Where the cache under test (A) and the -d cache (B) disagree, by PC */
+typedef struct diff_pc{
+	uint pc;
+	int used;
+	long a_miss;    /* A missed, B hit */
+	long b_miss;    /* B missed, A hit */
+} diff_pc_t;
+
+cache_t diff_cache;            /* B, fed the same accesses as cache */
+int diff_index = 0;            /* B's configuration; no B if diff_assoc is 0 */
+int diff_blocksize = 0;
+int diff_assoc = 0;
+int diff_policy = REPLACE_LRU;
+FILE *diff_log = NULL;         /* one line per divergent access, if wanted */
+diff_pc_t *diff_pcs = NULL;    /* open-addressed, diff_pcs_size a power of two */
+long diff_pcs_size = 0;
+long diff_pcs_used = 0;
+long *diff_a_sets = NULL;      /* A-only misses per set of A */
+long *diff_b_sets = NULL;      /* B-only misses per set of B */
+long diff_a_miss = 0;
+long diff_b_miss = 0;
+
+long mix_timeslice = 0;        /* instructions per timeslice; 0: not mixing */
+double mix_flush = 0;          /* fraction of cache lines dropped per switch */
+uint mix_seed = 1;             /* picks the lines a partial flush drops */
+
+/* One contiguous piece of a time-sliced run, and what its worker measured */
+typedef struct slice{
+	long start, end;    /* instructions [start, end) of the trace */
+	long overlap;       /* instructions after start both neighbours simulate */
+	sim_result_t head;  /* [start, start+overlap), as this worker saw it */
+	sim_result_t body;  /* [start, end) */
+	sim_result_t tail;  /* [end, end+overlap of the next slice) */
+	pid_t pid;
+	int fd;
+} slice_t;
+
+long slice_count = 0;          /* slices to cut the trace into; 0: one run */
+long slice_warmup = 100000;    /* instructions before a slice that only warm the cache */
+
 /* Cache Functions */
 
+/*
+ * Size in bits of a cache with the given geometry: data, tag and valid bit
+ * for every line.  A tag is what is left of the block address once the
+ * set is known: the bits above the index for a power-of-two count of
+ * sets, and the quotient by the count, one bit wider, for any other.
+ */
+unsigned long
+iplc_sim_cache_size(int sets, int blocksize, int assoc)
+{
+	/* log(x)/log(2) = log_2(x)
+	 * word_count * 4 bytes/word
+	 * Note: rint function rounds the result up prior to casting
+	 */
+	int blockoffsetbits = (int) rint((log( (double) (blocksize * 4) )/ log(2)));
+	int setbits = 0;
+
+	while(2 << setbits <= sets)
+		setbits++;
+	return (unsigned long) assoc * sets * ((32 * blocksize) + 33 - setbits - blockoffsetbits);
+}
+
+/*
+ * Bytes of arena a cache with sets sets of assoc lines takes.
+ */
+size_t
+iplc_sim_cache_bytes(int sets, int assoc)
+{
+	return iplc_sim_arena_round(sizeof(cache_set_t) * sets) +
+		iplc_sim_arena_round(sizeof(cache_line_t) * assoc * sets);
+}
+
+/*
+ * Build an empty cache of the given geometry out of arena a.  The set
+ * array and the lines are each one contiguous run, so a lookup touches
+ * one set and the adjacent lines of that set.
+ */
+void
+iplc_sim_cache_init(cache_t *c, arena_t *a, int sets, int blocksize, int assoc)
+{
+	int i=0;
+	cache_line_t *lines;
+
+	memset(c, 0, sizeof(cache_t));
+	c->nsets = sets;
+	while((1 << c->index) < sets)
+		c->index++;
+	if(sets & (sets - 1))
+		c->setmul = ~0ull / sets + 1;
+	c->blocksize = blocksize;
+	c->assoc = assoc;
+	c->capacity = (long) sets * assoc * blocksize * 4;
+	c->blockoffsetbits = (int) rint((log( (double) (blocksize * 4) )/ log(2)));
+
+	c->sets = (cache_set_t*) iplc_sim_arena_alloc(a, sizeof(cache_set_t) * sets);
+	lines = (cache_line_t*) iplc_sim_arena_alloc(a, sizeof(cache_line_t) * assoc * sets);
+
+	// Lines come zeroed: invalid, tag 0, unlinked
+	for(i = 0; i < sets; ++i){
+		c->sets[i].lines = &lines[i * assoc];
+		c->sets[i].lru_head = c->sets[i].lru_tail = &c->sets[i].lines[0];
+	}
+}
+
 /*
  * Correctly configure the cache.
  */
 void
 iplc_sim_init(int index, int blocksize, int assoc)
 {
-	int i=0, j=0;
+	int i=0;
 	unsigned long cache_size = 0;
-	cache_index = index;
-	cache_blocksize = blocksize;
-	cache_assoc = assoc;
-	
-	/* log(x)/log(2) = log_2(x)
-	 * word_count * 4 bytes/word
-	 * Note: rint function rounds the result up prior to casting
-	 */	
-	cache_blockoffsetbits = (int) rint((log( (double) (blocksize * 4) )/ log(2)));
-	
-	cache_size = assoc * ( 1 << index ) * ((32 * blocksize) + 33 - index - cache_blockoffsetbits);
-	
-	printf("Cache Configuration \n");
-	printf("   Index: %d bits or %d lines \n", cache_index, (1<<cache_index) );
-	printf("   BlockSize: %d \n", cache_blocksize );
-	printf("   Associativity: %d \n", cache_assoc );
-	printf("   BlockOffSetBits: %d \n", cache_blockoffsetbits );
-	printf("   CacheSize: %lu \n", cache_size );
-	
-	if(cache_size > MAX_CACHE_SIZE){
-		printf("Cache too big. Great than MAX SIZE of %d .... \n", MAX_CACHE_SIZE);
-		exit(-1);
+	int sets = l1_sets ? l1_sets : 1 << index;
+	size_t bytes = iplc_sim_cache_bytes(sets, assoc);
+
+	if(diff_assoc)
+		bytes += iplc_sim_diff_bytes(sets);
+	bytes += iplc_sim_lower_bytes();
+	iplc_sim_arena_reserve(&arena, bytes);
+	iplc_sim_cache_init(&cache, &arena, sets, blocksize, assoc);
+	iplc_sim_lower_init(&arena);
+	cache.policy = cache_policy;
+	cache_size = iplc_sim_cache_size(sets, blocksize, assoc);
+
+	if(verbose){
+		printf("Cache Configuration \n");
+		if(cache.setmul)
+			printf("   Sets: %u \n", cache.nsets );
+		else
+			printf("   Index: %d bits or %d lines \n", cache.index, (1<<cache.index) );
+		printf("   BlockSize: %d \n", cache.blocksize );
+		printf("   Associativity: %d \n", cache.assoc );
+		printf("   BlockOffSetBits: %d \n", cache.blockoffsetbits );
+		printf("   CacheSize: %lu \n", cache_size );
+		if(cache.setmul)
+			printf("   Capacity: %ld bytes \n", cache.capacity );
+		if(cache.policy != REPLACE_LRU)
+			printf("   Replacement: FIFO \n");
 	}
-	
-	cache = (cache_set_t*) malloc(sizeof(cache_set_t) * (1<<index));
-	
-	// Dynamically create our cache based on the information the user entered
-	for(i = 0; i < (1<<index); ++i){
-		cache[i].lines = (cache_line_t*) malloc(sizeof(cache_line_t) * assoc);
-		cache[i].lru_head = cache[i].lru_tail = &cache[i].lines[0];
-		for(j = 0; j < assoc; ++j){
-			cache[i].lines[j].valid = 0;
-			cache[i].lines[j].tag = 0;
-			cache[i].lines[j].lru_prev = cache[i].lines[j].lru_next = NULL;
-		}
+
+	if(cache_size > max_cache_size){
+		printf("Cache too big. Great than MAX SIZE of %lu .... \n", max_cache_size);
+		exit(-1);
 	}
-	
+	if(diff_assoc)
+		iplc_sim_diff_init(&arena);
+	if(page_policy != PAGE_NONE)
+		iplc_sim_page_init();
+	if(nlocks)
+		iplc_sim_lock_init();
+	/* timings hold for one prediction policy; start afresh */
+	if(block_memos)
+		memset(block_memos, 0, sizeof(block_memo_t) * block_memos_size);
+	block_memos_used = 0;
+
 	// init the pipeline -- set all data to zero and instructions to NOP
 	for(i = 0; i < MAX_STAGES; ++i){
 		// itype is set to O which is NOP type instruction
 		bzero(&(pipeline[i]), sizeof(pipeline_t));
 	}
+	pipeline_cycles = 0;
+	split_access = 0;
+	memset(&fill, 0, sizeof(fill));
+	fill_bus_free = 0;
+	for(i = 0; i < nregions; i++)
+		region[i].access = 0;
+	memset(&retire_latency, 0, sizeof(hist_t));
+	memset(&miss_latency, 0, sizeof(hist_t));
+	instruction_count = 0;
+	branch_count = 0;
+	correct_branch_predictions = 0;
+}
+
+/*
+ * Release what iplc_sim_init built.  Calling iplc_sim_init again without
+ * this reuses the arena when it is big enough.
+ */
+void
+iplc_sim_free()
+{
+	iplc_sim_arena_free(&arena);
+	memset(&cache, 0, sizeof(cache_t));
+	memset(&diff_cache, 0, sizeof(cache_t));
+	free(diff_pcs);
+	diff_pcs = NULL;
+	free(pages);
+	pages = NULL;
+	free(page_next);
+	page_next = NULL;
+	free(page_taken);
+	page_taken = NULL;
+	free(block_memos);
+	block_memos = NULL;
+	block_memos_size = 0;
+}
+
+/* Arena allocation */
+
+/* Round size up to a whole number of host cache lines. */
+size_t
+iplc_sim_arena_round(size_t size)
+{
+	return (size + HOST_LINE - 1) & ~(size_t)(HOST_LINE - 1);
+}
+
+/*
+ * Make a empty, holding at least size bytes.  The block is kept when it
+ * is already big enough, so re-initialising for the next configuration
+ * of a sweep costs a memset.
+ */
+void
+iplc_sim_arena_reserve(arena_t *a, size_t size)
+{
+	size = iplc_sim_arena_round(size);
+	if(a->size < size){
+		void *p;
+
+		iplc_sim_arena_free(a);
+		if(posix_memalign(&p, HOST_LINE, size) != 0){
+			printf("Out of memory for %lu bytes of simulator state \n", (unsigned long)size);
+			exit(-1);
+		}
+		a->base = (byte*) p;
+		a->size = size;
+	}
+	memset(a->base, 0, size);
+	a->used = 0;
+}
+
+/*
+ * Carve size zeroed bytes, starting on a host cache line, out of a.
+ */
+void *
+iplc_sim_arena_alloc(arena_t *a, size_t size)
+{
+	void *p;
+
+	size = iplc_sim_arena_round(size);
+	if(a->used + size > a->size){
+		printf("Arena overflow: %lu of %lu bytes used, %lu more wanted \n",
+			   (unsigned long)a->used, (unsigned long)a->size, (unsigned long)size);
+		exit(-1);
+	}
+	p = a->base + a->used;
+	a->used += size;
+	return p;
+}
+
+void
+iplc_sim_arena_free(arena_t *a)
+{
+	free(a->base);
+	memset(a, 0, sizeof(arena_t));
 }
 
 /*
- * iplc_sim_trap_address() determined this is not in our cache. Put it there
+ * iplc_sim_cache_lookup() determined this is not in our cache. Put it there
  * and make sure that is now our Most Recently Used (MRU) entry.
  */
 void
-iplc_sim_LRU_replace_on_miss(int index, int assoc_entry, int tag)
+iplc_sim_LRU_replace_on_miss(cache_t *c, int index, int assoc_entry, uint tag)
 {
 	/*
 	 * assoc != -1 means filling an unused slot
 	 * assoc == -1 means replacing old data
 	 */
+	cache_set_t *set = &c->sets[index];
 	cache_line_t* line=NULL;
 	if(assoc_entry == -1){
 		/* No more unused space. Replace the oldest entry */
-		line = cache[index].lru_tail;
+		line = set->lru_tail;
+		if(line->dirty){
+			c->victim = (line->tag * c->nsets + index) << c->blockoffsetbits;
+			c->victim_asid = line->asid;
+			c->victim_dirty = 1;
+			c->writebacks++;
+		}
 		if(line->lru_next){
 			// Keep tail valid if >1-way associative
-			cache[index].lru_tail = line->lru_next;
-			cache[index].lru_tail->lru_prev = NULL;
+			set->lru_tail = line->lru_next;
+			set->lru_tail->lru_prev = NULL;
 		}
 	}else{
 		/* Unused space at assoc_entry (determined by trap_address) */
-		line = &cache[index].lines[assoc_entry];
+		line = &set->lines[assoc_entry];
 	}
 
 	line->valid = 1;
 	line->tag = tag;
+	line->asid = c->asid;
+	line->dirty = 0;
 
-	if(line != cache[index].lru_head){
-		cache[index].lru_head->lru_next = line;
-		line->lru_prev = cache[index].lru_head;
+	if(line != set->lru_head){
+		set->lru_head->lru_next = line;
+		line->lru_prev = set->lru_head;
 		line->lru_next = NULL;
-		cache[index].lru_head = line;
+		set->lru_head = line;
 	}
 }
 
-/* iplc_sim_trap_address() determines the entry is in our cache.  
+/* iplc_sim_cache_lookup() determines the entry is in our cache.
  * Update its information in the cache.
  */
 void
-iplc_sim_LRU_update_on_hit(int index, int assoc_entry)
+iplc_sim_LRU_update_on_hit(cache_t *c, int index, int assoc_entry)
 {
-	cache_line_t* line = &cache[index].lines[assoc_entry];
+	cache_set_t *set = &c->sets[index];
+	cache_line_t* line = &set->lines[assoc_entry];
 	
-	/* Not the head, and cache_assoc > 1 */
+	/* Not the head, and assoc > 1 */
 	if(line->lru_next) {
 		line->lru_next->lru_prev = line->lru_prev;
 
@@ -236,494 +978,5063 @@ iplc_sim_LRU_update_on_hit(int index, int assoc_entry)
 			/* It's the tail, and not the head;
 			 * we should set tail to the next entry before we leave.
 			 */
-			cache[index].lru_tail = line->lru_next;
-			cache[index].lru_tail->lru_prev = NULL;
+			set->lru_tail = line->lru_next;
+			set->lru_tail->lru_prev = NULL;
 		}
 		/* Make this the head */
-		cache[index].lru_head->lru_next = line;
-		line->lru_prev = cache[index].lru_head;
+		set->lru_head->lru_next = line;
+		line->lru_prev = set->lru_head;
 		line->lru_next = NULL;
-		cache[index].lru_head = line;
+		set->lru_head = line;
 	}
 	/* Nothing to be done if this entry is already the head */
 }
 
-/* Check if the address is in our cache.  Update our counter statistics 
- * for cache_access, cache_hit, etc.  If our configuration supports
+/*
+ * The set and the tag of block in c.  A power-of-two count of sets takes
+ * the low bits of the block address and leaves the rest as the tag; any
+ * other count takes the remainder and the quotient by the count, by
+ * multiplying with the precomputed c->setmul rather than dividing
+ * (Lemire, Kaser and Kurz, "Faster Remainder by Direct Computation").
+ */
+static uint
+cache_set_of(cache_t *c, uint block)
+{
+	if(c->setmul)
+		return (uint) (((unsigned __int128) (c->setmul * block) * c->nsets) >> 64);
+	return block & (c->nsets - 1);
+}
+
+static uint
+cache_tag_of(cache_t *c, uint block)
+{
+	if(c->setmul)
+		return (uint) (((unsigned __int128) c->setmul * block) >> 64);
+	return block >> c->index;
+}
+
+/* Check if the address is in cache c.  Update its counter statistics
+ * for access, hit, etc.  If the configuration supports
  * associativity we may need to check through multiple entries for our
  * desired index.  In that case we will also need to call the LRU functions.
+ * A write leaves the line dirty; evicting a dirty line is noted in
+ * c->victim and c->victim_dirty.
  */
 int
-iplc_sim_trap_address(uint address)
+iplc_sim_cache_lookup(cache_t *c, uint address, int write)
 {
 	int i=0, index=0;
-	int tag=0;
-	
-	uint mask = ((1 << cache_index) - 1) << cache_blockoffsetbits; // Mask to get the index bits from the address
-	uint non_tag_bits = cache_blockoffsetbits + cache_index;
+	uint tag=0;
+	cache_line_t *lines;
+	uint block = address >> c->blockoffsetbits;
 
-	index = (address & mask) >> cache_blockoffsetbits;
-	tag = address >> non_tag_bits; // Extract the most significant bits
+	index = cache_set_of(c, block);
+	tag = cache_tag_of(c, block); // Extract the most significant bits
+	lines = c->sets[index].lines;
 
-	printf("Address %x: Tag= %x, Index= %d \n", address, tag, index);
-
-	++cache_access;
-	for (; i < cache_assoc; ++i){
-		if (cache[index].lines[i].valid){
-			if (cache[index].lines[i].tag == tag){
+	c->victim_dirty = 0;
+	++c->access;
+	for (; i < c->assoc; ++i){
+		if (lines[i].valid){
+			if (lines[i].tag == tag && lines[i].asid == c->asid){
 				// HIT!
-				++cache_hit;
-				iplc_sim_LRU_update_on_hit(index, i);
+				++c->hit;
+				lines[i].dirty |= write;
+				if(i < c->sets[index].locked)
+					++c->lock_hits;
+				else if(c->policy == REPLACE_LRU)
+					iplc_sim_LRU_update_on_hit(c, index, i);
+				c->last_line = &lines[i];
 				return 1;
 			}
 		}else{
 			// Stop searching; it's not here
-			++cache_miss;
-			iplc_sim_LRU_replace_on_miss(index, i, tag);
+			++c->miss;
+			iplc_sim_LRU_replace_on_miss(c, index, i, tag);
+			lines[i].dirty = write;
+			c->last_line = &lines[i];
 			return 0;
 		}
 	}
 
 	/* Out of space! Replace the oldest */
-	++cache_miss;
-	iplc_sim_LRU_replace_on_miss(index, -1, tag);
+	++c->miss;
+	iplc_sim_LRU_replace_on_miss(c, index, -1, tag);
+	c->sets[index].lru_head->dirty = write;
+	c->last_line = c->sets[index].lru_head;
 	return 0;
 }
 
-/* iplc_sim_finalize
- * Output the summary statistics of the simulation.
+/*
+ * A fetch from the block the last fetch came from, when that block is
+ * still the most recent of its set or is pinned, hits without a way scan: a full
+ * lookup would find it and leave the order of the set as it is.  1 and
+ * counted as a hit if so; 0, with nothing counted, if a lookup is needed.
  */
-void
-iplc_sim_finalize()
+int
+iplc_sim_cache_refetch(cache_t *c, uint address)
 {
-	/* Finish processing all instructions in the Pipeline  */
-	while (pipeline[FETCH].itype != NOP  ||
-		   pipeline[DECODE].itype != NOP ||
-		   pipeline[ALU].itype != NOP	||
-		   pipeline[MEM].itype != NOP	||
-		   pipeline[WRITEBACK].itype != NOP){
-		iplc_sim_push_pipeline_stage();
+	cache_line_t *line = c->fetch_line;
+	uint block = address >> c->blockoffsetbits;
+	cache_set_t *set;
+
+	if(block != c->fetch_block || line == NULL)
+		return 0;
+	set = &c->sets[cache_set_of(c, block)];
+	/* a pinned line stays where it is too */
+	if((line != set->lru_head && line >= set->lines + set->locked) || !line->valid ||
+	   line->tag != cache_tag_of(c, block) || line->asid != c->asid)
+		return 0;
+	if(line < set->lines + set->locked)
+		++c->lock_hits;
+	++c->access;
+	++c->hit;
+	c->victim_dirty = 0;
+	return 1;
+}
+
+/* Would a lookup of address in c hit?  Nothing is changed or counted. */
+int
+iplc_sim_cache_probe(cache_t *c, uint address)
+{
+	uint block = address >> c->blockoffsetbits, tag = cache_tag_of(c, block);
+	cache_line_t *lines = c->sets[cache_set_of(c, block)].lines;
+	int i;
+
+	for(i = 0; i < c->assoc && lines[i].valid; i++)
+		if(lines[i].tag == tag && lines[i].asid == c->asid)
+			return 1;
+	return 0;
+}
+
+/* The set of cache c that address maps to.
+ */
+int
+iplc_sim_cache_set(cache_t *c, uint address)
+{
+	return cache_set_of(c, address >> c->blockoffsetbits);
+}
+
+/*
+ * Parse an index given as bits, or as a count of sets with an s after
+ * it, into *sets; -1 if it is neither.
+ */
+int
+iplc_sim_parse_sets(char *s, int *sets)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+
+	if(end == s)
+		return -1;
+	if(*end == 's' && end[1] == '\0' && n > 0 && n <= 1 << 24){
+		*sets = n;
+		return 0;
 	}
-	
-	printf(" Cache Performance \n");
-	printf("\t Number of Cache Accesses is %ld \n", cache_access);
-	printf("\t Number of Cache Misses is %ld \n", cache_miss);
-	printf("\t Number of Cache Hits is %ld \n", cache_hit);
-	printf("\t Cache Miss Rate is %f \n\n", (double)cache_miss / (double)cache_access);
-	printf("Pipeline Performance \n");
-	printf("\t Total Cycles is %u \n", pipeline_cycles);
-	printf("\t Total Instructions is %u \n", instruction_count);
-	printf("\t Total Branch Instructions is %u \n", branch_count);
-	printf("\t Total Correct Branch Predictions is %u \n", correct_branch_predictions);
-	printf("\t CPI is %f \n\n", (double)pipeline_cycles / (double)instruction_count);
+	if(*end != '\0' || n < 0 || n > 24)
+		return -1;
+	*sets = 1 << n;
+	return 0;
+}
+
+/* A small deterministic generator, so partial flushes are repeatable. */
+static uint
+mix_random()
+{
+	mix_seed ^= mix_seed << 13;
+	mix_seed ^= mix_seed >> 17;
+	mix_seed ^= mix_seed << 5;
+	return mix_seed;
 }
 
-/* Pipeline Functions  */
 /*
- * Dump the current contents of our pipeline.
+ * Drop each valid line of c with the given probability, as a context
+ * switch that disturbs the cache would.  Lookups expect the valid lines
+ * of a set to fill it from slot 0 up, so each set is rebuilt from its
+ * survivors, oldest first, which keeps their LRU (or FIFO) order.
+ * Pinned lines stay.
  */
 void
-iplc_sim_dump_pipeline()
+iplc_sim_cache_flush(cache_t *c, double fraction)
 {
-	int i;
-	
-	for(i = 0; i < MAX_STAGES; i++){
-		uint iaddr = pipeline[i].instruction_address;
-		switch(i){
-		case FETCH:
-			printf("(cyc: %u) FETCH:\t %d: 0x%x \t", pipeline_cycles, pipeline[i].itype, iaddr);
-			break;
-		case DECODE:
-			printf("DECODE:\t %d: 0x%x \t", pipeline[i].itype, iaddr);
-			break;
-		case ALU:
-			printf("ALU:\t %d: 0x%x \t", pipeline[i].itype, iaddr);
-			break;
-		case MEM:
-			printf("MEM:\t %d: 0x%x \t", pipeline[i].itype, iaddr);
-			break;
-		case WRITEBACK:
-			printf("WB:\t %d: 0x%x \n", pipeline[i].itype, iaddr);
-			break;
-		default:
-			printf("DUMP: Bad stage!\n" );
-			exit(-1);
+	int i, j, n;
+	uint drop = fraction >= 1 ? ~0u : (uint)(fraction * 4294967296.0);
+	uint tags[c->assoc], asids[c->assoc];
+	int dirty[c->assoc];
+	uint asid = c->asid;
+	cache_line_t *line;
+
+	for(i = 0; i < c->nsets; ++i){
+		cache_set_t *set = &c->sets[i];
+
+		n = 0;
+		for(line = set->lru_tail; line && line->valid; line = line->lru_next)
+			if(fraction < 1 && mix_random() >= drop){
+				tags[n] = line->tag;
+				dirty[n] = line->dirty;
+				asids[n++] = line->asid;
+			}
+		for(j = set->locked; j < c->assoc; ++j)
+			memset(&set->lines[j], 0, sizeof(cache_line_t));
+		set->lru_head = set->lru_tail = &set->lines[set->locked];
+		for(j = 0; j < n; ++j){
+			c->asid = asids[j];
+			iplc_sim_LRU_replace_on_miss(c, i, set->locked + j, tags[j]);
+			set->lines[set->locked + j].dirty = dirty[j];
 		}
 	}
+	c->asid = asid;
 }
 
-/* test the given instruction to see if it's immeadiate */
+/* Do the size bytes at address span two blocks of c?
+ */
 int
-immeadiate_instruction_p(const char *instr)
+iplc_sim_crosses_block(cache_t *c, uint address, int size)
 {
-	return strncmp(instr, "addi", 4) != 0
-		&& strncmp(instr, "ori", 3) != 0
-		&& strncmp(instr, "sll", 3) != 0;
+	return (address >> c->blockoffsetbits) != ((address + size - 1) >> c->blockoffsetbits);
 }
 
+/* Cache locking */
+
 /*
- * Check if various stages of our pipeline require stalls, forwarding, etc.
- * Then push the contents of our various pipeline stages through the pipeline.
- * record cycle count, correct branch predictions, and other data in execution.
+ * Parse one -K base,size[,lockpc[,unlockpc]] into locks[]; -1 if it is
+ * not that.
  */
-void
-iplc_sim_push_pipeline_stage()
+int
+iplc_sim_parse_lock(char *s)
 {
-	int i;
-	int data_hit=1;
-	int cycle_count=1;
-	
-	/* 1. Count WRITEBACK stage is "retired" -- This I'm giving you */
-	if(pipeline[WRITEBACK].instruction_address){
-		instruction_count++;
-		if(debug)
-			printf("DEBUG: Retired Instruction at 0x%x, Type %d, at Time %u \n",
-				   pipeline[WRITEBACK].instruction_address, pipeline[WRITEBACK].itype, pipeline_cycles);
+	long long base, size, lock_pc = 0, unlock_pc = 0;
+	int n = sscanf(s, "%lli,%lli,%lli,%lli", &base, &size, &lock_pc, &unlock_pc);
+
+	if(n < 2 || nlocks == MAX_LOCKS || base < 0 || size <= 0 || base + size > 1ll << 32 ||
+	   lock_pc < 0 || lock_pc >= 1ll << 32 || unlock_pc < 0 || unlock_pc >= 1ll << 32)
+		return -1;
+	locks[nlocks].base = base;
+	locks[nlocks].size = size;
+	locks[nlocks].lock_pc = lock_pc;
+	locks[nlocks].unlock_pc = unlock_pc;
+	nlocks++;
+	return 0;
+}
+
+/*
+ * Pin the block at address in the cache, loading it if need be, or
+ * unpin it, leaving it the most recent of its set.  A set keeps at least
+ * one way unpinned, so misses to it still have somewhere to go; a block
+ * that would take that way is refused.  The set is rebuilt with its
+ * pinned lines first, then the rest oldest first, as a flush does; a
+ * line that no longer fits is evicted, and written back if dirty.
+ */
+static void
+lock_block(uint address, int lock)
+{
+	cache_t *c = &cache;
+	uint block, tag, asid = c->asid;
+	int i, j, nl = 0, n = 0, first, dirty = 0, where = 0;
+	cache_set_t *set;
+	cache_line_t *line;
+	uint ltags[c->assoc], lasids[c->assoc], tags[c->assoc + 1], asids[c->assoc + 1];
+	int ldirty[c->assoc], udirty[c->assoc + 1];
+
+	if(page_policy != PAGE_NONE && !page_virtual_l1)
+		address = iplc_sim_translate(asid, address);
+	block = address >> c->blockoffsetbits;
+	tag = cache_tag_of(c, block);
+	i = cache_set_of(c, block);
+	set = &c->sets[i];
+
+	/* the pinned lines, then the rest oldest first, all but the block */
+	for(j = 0; j < set->locked; j++){
+		line = &set->lines[j];
+		if(line->tag == tag && line->asid == asid){
+			where = 1;
+			dirty = line->dirty;
+			continue;
+		}
+		ltags[nl] = line->tag;
+		lasids[nl] = line->asid;
+		ldirty[nl++] = line->dirty;
 	}
-	
-	/* 2. Check for BRANCH and correct/incorrect Branch Prediction */
-	if(pipeline[DECODE].itype == BRANCH){
-		int branch_taken =
-			(pipeline[FETCH].instruction_address != pipeline[DECODE].instruction_address + 4) && (pipeline[FETCH].itype != NOP);
-		if(branch_taken == 1){
-			printf("DEBUG: Branch Taken: FETCH addr = 0x%x, DECODE instr addr = 0x%x \n",
-					pipeline[FETCH].instruction_address, pipeline[DECODE].instruction_address);
+	for(line = set->lru_tail; line && line->valid; line = line->lru_next){
+		if(line->tag == tag && line->asid == asid){
+			where = 2;
+			dirty = line->dirty;
+			continue;
 		}
-		if (branch_taken == branch_predict_taken){
-			correct_branch_predictions++;
-			// if (debug)
-				
-		}else{
-			cycle_count = 2;
+		tags[n] = line->tag;
+		asids[n] = line->asid;
+		udirty[n++] = line->dirty;
+	}
+	if(lock ? where == 1 : where != 1)
+		return;
+	if(lock){
+		if(nl == c->assoc - 1){
+			lock_refused++;
+			return;
 		}
-		
+		ltags[nl] = tag;
+		lasids[nl] = asid;
+		ldirty[nl++] = dirty;
+		c->locked++;
+	}else{
+		tags[n] = tag;
+		asids[n] = asid;
+		udirty[n++] = dirty;
+		c->locked--;
 	}
-	
-	switch(pipeline[MEM].itype){
-	/* 3. Check for LW delays due to use in ALU stage and if data hit/miss
-	 *	add delay cycles if needed.
-	 */
-	case LW:
-		if(!iplc_sim_trap_address(pipeline[MEM].stage.lw.data_address)){
-			cycle_count = CACHE_MISS_DELAY;
-			printf("DATA MISS:\t Address 0x%x\n", pipeline[MEM].stage.lw.data_address);
-		}else{
-			printf("DATA HIT:\t Address 0x%x\n", pipeline[MEM].stage.lw.data_address);
+
+	first = n > c->assoc - nl ? n - (c->assoc - nl) : 0;
+	for(j = 0; j < first; j++)
+		if(udirty[j]){
+			uint victim = (tags[j] * c->nsets + i) << c->blockoffsetbits;
+
+			if(page_policy != PAGE_NONE && page_virtual_l1)
+				victim = iplc_sim_translate(asids[j], victim);
+			c->writebacks++;
+			iplc_sim_lower_access(0, victim, ACCESS_WRITEBACK, asids[j]);
 		}
-		break;
-	/* 4. Check for SW mem access and data miss .. add delay cycles if needed */
-	case SW:
-		if(!iplc_sim_trap_address(pipeline[MEM].stage.sw.data_address)){
-			cycle_count = CACHE_MISS_DELAY;
-			printf("DATA MISS:\t Address 0x%x\n", pipeline[MEM].stage.sw.data_address);
-		}else{
-			printf("DATA HIT:\t Address 0x%x\n", pipeline[MEM].stage.sw.data_address);
+	for(j = 0; j < c->assoc; ++j)
+		memset(&set->lines[j], 0, sizeof(cache_line_t));
+	for(j = 0; j < nl; ++j){
+		set->lines[j].valid = 1;
+		set->lines[j].tag = ltags[j];
+		set->lines[j].asid = lasids[j];
+		set->lines[j].dirty = ldirty[j];
+	}
+	set->locked = nl;
+	set->lru_head = set->lru_tail = &set->lines[nl];
+	for(j = first; j < n; ++j){
+		c->asid = asids[j];
+		iplc_sim_LRU_replace_on_miss(c, i, nl + j - first, tags[j]);
+		set->lines[nl + j - first].dirty = udirty[j];
+	}
+	c->asid = asid;
+	c->fetch_line = NULL;
+}
+
+/*
+ * Pin, or unpin, every block of the cache the size bytes at base touch.
+ * Locking is done the way lockdown software does it, ahead of time: it
+ * takes no cycles and what it loads is not counted as accesses.
+ */
+void
+iplc_sim_lock_range(uint base, uint size, int lock)
+{
+	uint bytes = cache.blocksize * 4;
+	unsigned long long a;
+
+	for(a = base & ~(bytes - 1); a < (unsigned long long) base + size; a += bytes)
+		lock_block(a, lock);
+}
+
+/* Lock what is locked from the start, in the cache iplc_sim_init just built. */
+void
+iplc_sim_lock_init()
+{
+	int i;
+
+	lock_refused = 0;
+	lock_markers = 0;
+	for(i = 0; i < nlocks; i++){
+		locks[i].locked = locks[i].lock_pc == 0;
+		if(locks[i].locked)
+			iplc_sim_lock_range(locks[i].base, locks[i].size, 1);
+		else
+			lock_markers++;
+	}
+}
+
+/* The instruction at pc is being fetched: lock or unlock what it marks. */
+void
+iplc_sim_lock_marker(uint pc)
+{
+	int i;
+
+	for(i = 0; i < nlocks; i++)
+		if(!locks[i].locked && locks[i].lock_pc == pc){
+			iplc_sim_lock_range(locks[i].base, locks[i].size, 1);
+			locks[i].locked = 1;
+		}else if(locks[i].locked && locks[i].unlock_pc == pc){
+			iplc_sim_lock_range(locks[i].base, locks[i].size, 0);
+			locks[i].locked = 0;
 		}
-		break;
+}
+
+void
+iplc_sim_lock_finalize()
+{
+	printf(" Cache Locking \n");
+	iplc_sim_stat_print(SECTION_LOCK, 0, NULL);
+	printf("\n");
+}
+
+/* Latency histograms */
+
+static int
+hist_bucket(uint v)
+{
+	int e;
+
+	if(v < (1u << HIST_SUB_BITS))
+		return v;
+	e = 31 - __builtin_clz(v) - HIST_SUB_BITS;
+	return ((e + 1) << HIST_SUB_BITS) + ((v >> e) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+/* The largest latency that falls in bucket b. */
+static uint
+hist_bucket_top(int b)
+{
+	int e;
+
+	if(b < (1 << HIST_SUB_BITS))
+		return b;
+	e = (b >> HIST_SUB_BITS) - 1;
+	return (((uint)((1 << HIST_SUB_BITS) + (b & ((1 << HIST_SUB_BITS) - 1))) << e) + ((1u << e) - 1));
+}
+
+void
+iplc_sim_hist_add(hist_t *h, uint v)
+{
+	h->count[hist_bucket(v)]++;
+	if(v > h->max)
+		h->max = v;
+}
+
+/*
+ * The latency at or below which a fraction p of those in h fall, to
+ * within its bucket; never more than the largest seen.
+ */
+uint
+iplc_sim_hist_percentile(hist_t *h, double p)
+{
+	long n = 0, seen = 0;
+	int b;
+
+	for(b = 0; b < HIST_BUCKETS; b++)
+		n += h->count[b];
+	for(b = 0; b < HIST_BUCKETS; b++){
+		seen += h->count[b];
+		if(seen > 0 && seen >= p * n)
+			return hist_bucket_top(b) < h->max ? hist_bucket_top(b) : h->max;
 	}
-	
-	/* 5. Increment pipe_cycles 1 cycle for normal processing */
-	pipeline_cycles += cycle_count;
+	return h->max;
+}
 
-	/* 6. push stages thru MEM->WB, ALU->MEM, DECODE->ALU, FETCH->DECODE */
-	pipeline[WRITEBACK] = pipeline[MEM];
-	pipeline[MEM] = pipeline[ALU];
-	pipeline[ALU] = pipeline[DECODE];
-	pipeline[DECODE] = pipeline[FETCH];
-	
-	/* Reset the FETCH stage to NOP via bezero */
-	bzero(&(pipeline[FETCH]), sizeof(pipeline_t));
+void
+iplc_sim_latency_finalize()
+{
+	printf("Latency Percentiles (cycles) \n");
+	printf("\t\t\t Count\t\t p50\t p90\t p99\t max \n");
+	iplc_sim_stat_print(SECTION_LATENCY, 0, NULL);
+	printf("\n");
+}
+
+/* One block's lookup on behalf of the pipeline; *latency gets its cycles. */
+static int
+trap_block(uint address, int type, uint pc, int *latency)
+{
+	int hit;
+	uint physical = address;
+
+	if(page_policy != PAGE_NONE){
+		physical = iplc_sim_translate(cache.asid, address);
+		if(!page_virtual_l1)
+			address = physical;
+	}
+	if(verbose)
+		printf("Address %x: Tag= %x, Index= %d \n", address,
+			   cache_tag_of(&cache, address >> cache.blockoffsetbits),
+			   iplc_sim_cache_set(&cache, address));
+	if(type == ACCESS_IFETCH && iplc_sim_cache_refetch(&cache, address))
+		hit = 1;
+	else{
+		hit = iplc_sim_cache_lookup(&cache, address, type == ACCESS_STORE);
+		if(type == ACCESS_IFETCH){
+			cache.fetch_line = cache.last_line;
+			cache.fetch_block = address >> cache.blockoffsetbits;
+		}
+	}
+	if(diff_cache.sets)
+		iplc_sim_diff_access(address, pc, hit);
+	*latency = 1;
+	trap_served = 0;
+	if(!hit){
+		if(miss_stream)
+			iplc_sim_miss_stream_record(type, physical, pc);
+		*latency = iplc_sim_lower_access(0, physical, type, cache.asid);
+		trap_served = lower_served;
+	}
+	if(beat_words)
+		*latency = iplc_sim_fill_latency(address, hit, *latency);
+	if(!hit && STAT_ON(STATS_LATENCY))
+		iplc_sim_hist_add(&miss_latency, *latency);
+	if(cache.victim_dirty){
+		uint victim = cache.victim;
+
+		if(page_policy != PAGE_NONE && page_virtual_l1)
+			victim = iplc_sim_translate(cache.victim_asid, victim);
+		if(miss_stream)
+			iplc_sim_miss_stream_record(ACCESS_WRITEBACK, victim, pc);
+		iplc_sim_lower_access(0, victim, ACCESS_WRITEBACK, cache.victim_asid);
+	}
+	return hit;
+}
+
+/* Look the size bytes at address up in the simulated cache on behalf of
+ * the pipeline; pc is the instruction making the access and type says
+ * what kind of access it is.  An access that straddles blocks, two or,
+ * for a doubleword in 4-byte blocks, three, looks each up, hits only if
+ * all do, and takes a cycle longer than the slowest.  *latency gets the
+ * cycles the access takes.
+ */
+int
+iplc_sim_trap_address(uint address, int size, int type, uint pc, int *latency)
+{
+	int hit;
+
+	if(nregions){
+		region_t *r = iplc_sim_region_find(address);
+
+		if(r){
+			if(verbose)
+				printf("Address %x: %s \n", address, r->kind == REGION_SCRATCH ? "Scratchpad" : "Uncached");
+			r->access++;
+			if(r->kind == REGION_UNCACHED)
+				++memory_access;
+			*latency = r->latency;
+			trap_code[0] = OUTCOME_FIXED;
+			trap_code[1] = OUTCOME_NONE;
+			trap_fixed = r->latency;
+			return r->kind == REGION_SCRATCH;
+		}
+	}
+	hit = trap_block(address, type, pc, latency);
+	trap_code[0] = trap_served;
+	trap_code[1] = OUTCOME_NONE;
+
+	if(iplc_sim_crosses_block(&cache, address, size)){
+		uint last = address + size - 1, block;
+		int next, more = 0;
+
+		++split_access;
+		/* the blocks in between, then the one holding the last byte */
+		for(block = (address >> cache.blockoffsetbits) + 1; ; block++){
+			uint at = block == last >> cache.blockoffsetbits ? last : block << cache.blockoffsetbits;
+
+			hit &= trap_block(at, type, pc, &next);
+			if(!more++ || trap_served > trap_code[1])
+				trap_code[1] = trap_served;
+			if(next > *latency)
+				*latency = next;
+			if(at == last)
+				break;
+		}
+		++*latency;
+	}
+	return hit;
+}
+
+/* Push whatever is left in the pipeline through to WRITEBACK.
+ */
+void
+iplc_sim_drain()
+{
+	while (pipeline[FETCH].itype != NOP  ||
+		   pipeline[DECODE].itype != NOP ||
+		   pipeline[ALU].itype != NOP	||
+		   pipeline[MEM].itype != NOP	||
+		   pipeline[WRITEBACK].itype != NOP){
+		iplc_sim_push_pipeline_stage();
+	}
 }
 
+/* Statistics registry */
+
+enum stat_kind {STAT_SCALAR, STAT_VECTOR, STAT_HIST, STAT_FORMULA};
+enum stat_flags {
+	STAT_IF_NONZERO = 1,
+	STAT_IF_LOWER = 2,
+	STAT_IF_SETS = 4,
+	STAT_RESULT = 8,    /* kept in a sim_result_t, or a formula over one */
+	STAT_COUNT = 16     /* a formula whose value is a whole number */
+};
+
 /*
- * Each of the iplc_sim_process_pipeline_* functions
- * prepares the fetch stage of our pipeline with the
- * instructions sent from iplc_sim_parse_instruction
+ * One named statistic.  Scalars and vectors point at the counter the
+ * simulator already keeps, width bytes wide; a vector, or a formula with
+ * a length, has *length elements, stride bytes apart.  A formula is
+ * worked out from a sim_result_t and element i.  Those with a label are
+ * also printed, in registry order, in their section of the summary; a
+ * section of vectors is printed once per element.
+ */
+typedef struct statistic{
+	char *name;         /* dotted, most general part first */
+	char *label;        /* in the summary, or NULL */
+	enum stat_kind kind;
+	uint group;
+	int section;
+	int flags;
+	void *value;
+	int width;
+	int *length;
+	int stride;
+	double (*formula)(sim_result_t *r, int i);
+	int result;         /* offset of its sim_result_t field, with STAT_RESULT */
+} statistic_t;
+
+static double
+stat_miss_rate(sim_result_t *r, int i)
+{
+	return r->access ? (double)r->miss / (double)r->access : 0;
+}
+
+static double
+stat_cpi(sim_result_t *r, int i)
+{
+	return r->instructions ? (double)r->cycles / (double)r->instructions : 0;
+}
+
+static double
+stat_mispredicts(sim_result_t *r, int i)
+{
+	return (double)r->branches - r->correct_branches;
+}
+
+static double
+stat_lines(sim_result_t *r, int i)
+{
+	return (double)cache.nsets * cache.assoc;
+}
+
+static double
+stat_unlocked_capacity(sim_result_t *r, int i)
+{
+	return (double)cache.capacity - (double)cache.locked * cache.blocksize * 4;
+}
+
+static double
+stat_unlocked_miss_rate(sim_result_t *r, int i)
+{
+	long unlocked = r->access - cache.lock_hits;
+
+	return unlocked ? (double)r->miss / (double)unlocked : 0;
+}
+
+static double
+stat_lower_miss_rate(sim_result_t *r, int i)
+{
+	return lower[i].access ? (double)lower[i].miss / (double)lower[i].access : 0;
+}
+
+statistic_t stat_registry[] = {
+	{"l1.sets", "Number of Sets", STAT_SCALAR, STATS_L1, SECTION_CACHE, STAT_IF_SETS,
+	 &cache.nsets, sizeof(uint)},
+	{"l1.capacity", "Capacity in Bytes", STAT_SCALAR, STATS_L1, SECTION_CACHE, STAT_IF_SETS,
+	 &cache.capacity, sizeof(long)},
+	{"l1.blocksize", NULL, STAT_SCALAR, STATS_L1, SECTION_NONE, 0,
+	 &cache.blocksize, sizeof(int)},
+	{"l1.assoc", NULL, STAT_SCALAR, STATS_L1, SECTION_NONE, 0,
+	 &cache.assoc, sizeof(int)},
+	{"l1.access", "Number of Cache Accesses", STAT_SCALAR, STATS_L1, SECTION_CACHE, STAT_RESULT,
+	 &cache.access, sizeof(long), NULL, 0, NULL, offsetof(sim_result_t, access)},
+	{"l1.miss", "Number of Cache Misses", STAT_SCALAR, STATS_L1, SECTION_CACHE, STAT_RESULT,
+	 &cache.miss, sizeof(long), NULL, 0, NULL, offsetof(sim_result_t, miss)},
+	{"l1.hit", "Number of Cache Hits", STAT_SCALAR, STATS_L1, SECTION_CACHE, STAT_RESULT,
+	 &cache.hit, sizeof(long), NULL, 0, NULL, offsetof(sim_result_t, hit)},
+	{"l1.miss_rate", "Cache Miss Rate", STAT_FORMULA, STATS_L1, SECTION_CACHE, STAT_RESULT,
+	 NULL, 0, NULL, 0, stat_miss_rate},
+	{"l1.straddle", "Number of Block-Straddling Accesses", STAT_SCALAR, STATS_L1, SECTION_CACHE,
+	 STAT_IF_NONZERO, &split_access, sizeof(long)},
+	{"l1.writeback", "Number of Writebacks", STAT_SCALAR, STATS_L1, SECTION_CACHE, STAT_IF_LOWER,
+	 &cache.writebacks, sizeof(long)},
+	{"l1.lines", "Number of Lines", STAT_FORMULA, STATS_L1, SECTION_LOCK, STAT_COUNT,
+	 NULL, 0, NULL, 0, stat_lines},
+	{"l1.lock.lines", "Locked Lines", STAT_SCALAR, STATS_L1, SECTION_LOCK, 0,
+	 &cache.locked, sizeof(long)},
+	{"l1.lock.capacity", "Unlocked Capacity in Bytes", STAT_FORMULA, STATS_L1, SECTION_LOCK,
+	 STAT_COUNT, NULL, 0, NULL, 0, stat_unlocked_capacity},
+	{"l1.lock.hits", "Hits on Locked Lines", STAT_SCALAR, STATS_L1, SECTION_LOCK, 0,
+	 &cache.lock_hits, sizeof(long)},
+	{"l1.lock.refused", "Lock Requests Refused", STAT_SCALAR, STATS_L1, SECTION_LOCK, 0,
+	 &lock_refused, sizeof(long)},
+	{"l1.lock.miss_rate", "Unlocked Miss Rate", STAT_FORMULA, STATS_L1, SECTION_LOCK, 0,
+	 NULL, 0, NULL, 0, stat_unlocked_miss_rate},
+	{"lower.access", "Number of Cache Accesses", STAT_VECTOR, STATS_LOWER, SECTION_LOWER, 0,
+	 &lower[0].access, sizeof(long), &nlower, sizeof(cache_t)},
+	{"lower.miss", "Number of Cache Misses", STAT_VECTOR, STATS_LOWER, SECTION_LOWER, 0,
+	 &lower[0].miss, sizeof(long), &nlower, sizeof(cache_t)},
+	{"lower.hit", "Number of Cache Hits", STAT_VECTOR, STATS_LOWER, SECTION_LOWER, 0,
+	 &lower[0].hit, sizeof(long), &nlower, sizeof(cache_t)},
+	{"lower.miss_rate", "Cache Miss Rate", STAT_FORMULA, STATS_LOWER, SECTION_LOWER, 0,
+	 NULL, 0, &nlower, 0, stat_lower_miss_rate},
+	{"lower.writeback", "Number of Writebacks", STAT_VECTOR, STATS_LOWER, SECTION_LOWER, 0,
+	 &lower[0].writebacks, sizeof(long), &nlower, sizeof(cache_t)},
+	{"lower.capacity", NULL, STAT_VECTOR, STATS_LOWER, SECTION_NONE, 0,
+	 &lower[0].capacity, sizeof(long), &nlower, sizeof(cache_t)},
+	{"memory.access", "Number of Memory Accesses", STAT_SCALAR, STATS_LOWER, SECTION_MEMORY, 0,
+	 &memory_access, sizeof(long)},
+	{"region.access", "Number of Accesses", STAT_VECTOR, STATS_LOWER, SECTION_REGION, 0,
+	 &region[0].access, sizeof(long), &nregions, sizeof(region_t)},
+	{"pages.size", "Page Size", STAT_SCALAR, STATS_PAGES, SECTION_PAGES, 0,
+	 &page_size, sizeof(uint)},
+	{"pages.colors", "Number of Colors", STAT_SCALAR, STATS_PAGES, SECTION_PAGES, 0,
+	 &page_colors, sizeof(uint)},
+	{"pages.mapped", "Number of Pages Mapped", STAT_SCALAR, STATS_PAGES, SECTION_PAGES, 0,
+	 &pages_used, sizeof(long)},
+	{"core.cycles", "Total Cycles", STAT_SCALAR, STATS_CORE, SECTION_PIPELINE, STAT_RESULT,
+	 &pipeline_cycles, sizeof(uint), NULL, 0, NULL, offsetof(sim_result_t, cycles)},
+	{"core.instructions", "Total Instructions", STAT_SCALAR, STATS_CORE, SECTION_PIPELINE,
+	 STAT_RESULT, &instruction_count, sizeof(uint), NULL, 0, NULL,
+	 offsetof(sim_result_t, instructions)},
+	{"core.branch.count", "Total Branch Instructions", STAT_SCALAR, STATS_CORE, SECTION_PIPELINE,
+	 STAT_RESULT, &branch_count, sizeof(uint), NULL, 0, NULL, offsetof(sim_result_t, branches)},
+	{"core.branch.correct", "Total Correct Branch Predictions", STAT_SCALAR, STATS_CORE,
+	 SECTION_PIPELINE, STAT_RESULT, &correct_branch_predictions, sizeof(uint), NULL, 0, NULL,
+	 offsetof(sim_result_t, correct_branches)},
+	{"core.branch.mispredict", NULL, STAT_FORMULA, STATS_CORE, SECTION_NONE, STAT_RESULT,
+	 NULL, 0, NULL, 0, stat_mispredicts},
+	{"core.cpi", "CPI", STAT_FORMULA, STATS_CORE, SECTION_PIPELINE, STAT_RESULT,
+	 NULL, 0, NULL, 0, stat_cpi},
+	{"latency.retire", "Fetch to Retire", STAT_HIST, STATS_LATENCY, SECTION_LATENCY, 0,
+	 &retire_latency},
+	{"latency.miss", "Miss Service", STAT_HIST, STATS_LATENCY, SECTION_LATENCY, 0,
+	 &miss_latency},
+};
+
+static char *stat_group_names[] = {"core", "l1", "lower", "pages", "latency"};
+
+/*
+ * The groups named in s, separated by commas, as a mask; -1 if one is
+ * unknown.
+ */
+int
+iplc_sim_stat_parse_groups(char *s)
+{
+	char name[16];
+	int mask = 0, n, g;
+
+	while(sscanf(s, "%15[^,]%n", name, &n) == 1){
+		for(g = 0; g < sizeof(stat_group_names) / sizeof(stat_group_names[0]); g++)
+			if(strcmp(name, stat_group_names[g]) == 0)
+				break;
+		if(g == sizeof(stat_group_names) / sizeof(stat_group_names[0]))
+			return -1;
+		mask |= 1 << g;
+		s += n;
+		if(*s == ',')
+			s++;
+	}
+	return mask;
+}
+
+/* The statistic called name; it must be registered. */
+statistic_t *
+iplc_sim_stat_find(char *name)
+{
+	int i;
+
+	for(i = 0; i < sizeof(stat_registry) / sizeof(statistic_t); i++)
+		if(strcmp(stat_registry[i].name, name) == 0)
+			return &stat_registry[i];
+	printf("No statistic called %s \n", name);
+	exit(-1);
+}
+
+/* Elements of st: 1 but for vectors. */
+int
+iplc_sim_stat_length(statistic_t *st)
+{
+	return st->length ? *st->length : 1;
+}
+
+/* Element i of scalar or vector st. */
+long
+iplc_sim_stat_value(statistic_t *st, int i)
+{
+	byte *p = (byte*) st->value + (long)i * st->stride;
+
+	return st->width == sizeof(uint) ? *(uint*)p : *(long*)p;
+}
+
+/* Element i of st, where r holds the counters a result keeps. */
+static double
+stat_get(statistic_t *st, int i, sim_result_t *r)
+{
+	if(st->kind == STAT_FORMULA)
+		return st->formula(r, i);
+	if(st->flags & STAT_RESULT)
+		return *(long*)((byte*) r + st->result);
+	return iplc_sim_stat_value(st, i);
+}
+
+/* Statistic name of result r, as the summary would have it. */
+double
+iplc_sim_stat_of(char *name, sim_result_t *r)
+{
+	return stat_get(iplc_sim_stat_find(name), 0, r);
+}
+
+/*
+ * The labelled, enabled statistics in section, element element of
+ * those that are vectors, as lines of the summary.  They are those of
+ * the simulation just run, or with r only those a result keeps, from r.
  */
+void
+iplc_sim_stat_print(int section, int element, sim_result_t *r)
+{
+	sim_result_t now;
+	int i, live = r == NULL;
+
+	if(live){
+		iplc_sim_result_collect(&now);
+		r = &now;
+	}
+	for(i = 0; i < sizeof(stat_registry) / sizeof(statistic_t); i++){
+		statistic_t *st = &stat_registry[i];
+		hist_t *h = (hist_t*) st->value;
+		long n = 0;
+		int b, col;
+
+		if(st->section != section || !st->label || !STAT_ON(st->group) ||
+		   (!live && !(st->flags & STAT_RESULT)))
+			continue;
+		if(((st->flags & STAT_IF_NONZERO) && stat_get(st, element, r) == 0) ||
+		   ((st->flags & STAT_IF_LOWER) && nlower == 0) ||
+		   ((st->flags & STAT_IF_SETS) && l1_sets == 0))
+			continue;
+		switch(st->kind){
+		case STAT_HIST:
+			for(b = 0; b < HIST_BUCKETS; b++)
+				n += h->count[b];
+			/* tab the label out to the Count column */
+			printf("\t %s", st->label);
+			for(col = 9 + strlen(st->label); col < 32; col = (col/8 + 1) * 8)
+				printf("\t");
+			printf(" %ld\t\t %u\t %u\t %u\t %u \n", n,
+				   iplc_sim_hist_percentile(h, 0.5), iplc_sim_hist_percentile(h, 0.9),
+				   iplc_sim_hist_percentile(h, 0.99), h->max);
+			break;
+		case STAT_FORMULA:
+			if(!(st->flags & STAT_COUNT)){
+				printf("\t %s is %f \n", st->label, st->formula(r, element));
+				break;
+			}
+			/* fall through */
+		default:
+			printf("\t %s is %ld \n", st->label, (long) stat_get(st, element, r));
+		}
+	}
+}
 
+/* Every enabled statistic, by name, as a JSON object in path. */
 void
-iplc_sim_process_pipeline_rtype(byte *instruction, int dest_reg, int reg1, int reg2_or_constant)
+iplc_sim_stat_dump(char *path)
 {
-	iplc_sim_push_pipeline_stage();
-	
-	pipeline[FETCH].itype = RTYPE;
-	pipeline[FETCH].instruction_address = instruction_address;
+	FILE *f = fopen(path, "w");
+	char *sep = "";
+	sim_result_t now;
+	int i, k;
+
+	if(f == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	iplc_sim_result_collect(&now);
+	fprintf(f, "{");
+	for(i = 0; i < sizeof(stat_registry) / sizeof(statistic_t); i++){
+		statistic_t *st = &stat_registry[i];
+		hist_t *h = (hist_t*) st->value;
+		double v;
+
+		if(!STAT_ON(st->group))
+			continue;
+		fprintf(f, "%s\n\"%s\": ", sep, st->name);
+		sep = ",";
+		if(st->kind == STAT_HIST){
+			fprintf(f, "{\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}",
+					iplc_sim_hist_percentile(h, 0.5), iplc_sim_hist_percentile(h, 0.9),
+					iplc_sim_hist_percentile(h, 0.99), h->max);
+			continue;
+		}
+		if(st->length)
+			fprintf(f, "[");
+		for(k = 0; k < iplc_sim_stat_length(st); k++){
+			v = stat_get(st, k, &now);
+			if(st->kind == STAT_FORMULA && !(st->flags & STAT_COUNT))
+				fprintf(f, "%s%.17g", k ? ", " : "", isfinite(v) ? v : 0);
+			else
+				fprintf(f, "%s%ld", k ? ", " : "", (long) v);
+		}
+		if(st->length)
+			fprintf(f, "]");
+	}
+	fprintf(f, "\n}\n");
+	fclose(f);
+}
+
+/* iplc_sim_finalize
+ * Output the summary statistics of the simulation.
+ */
+void
+iplc_sim_finalize()
+{
+	/* Finish processing all instructions in the Pipeline  */
+	iplc_sim_drain();
+	if(stats_page)
+		iplc_sim_stats_publish(1);
+	if(timeline)
+		iplc_sim_timeline_close();
 	
-	strcpy(pipeline[FETCH].stage.rtype.instruction, instruction);
-	pipeline[FETCH].stage.rtype.reg1 = reg1;
-	pipeline[FETCH].stage.rtype.reg2_or_constant = reg2_or_constant;
-	pipeline[FETCH].stage.rtype.dest_reg = dest_reg;
+	if(STAT_ON(STATS_L1)){
+		printf(" Cache Performance \n");
+		iplc_sim_stat_print(SECTION_CACHE, 0, NULL);
+		printf("\n");
+	}
+	if(nlocks && STAT_ON(STATS_L1))
+		iplc_sim_lock_finalize();
+	if(nlower && STAT_ON(STATS_LOWER))
+		iplc_sim_lower_finalize();
+	if(nregions && STAT_ON(STATS_LOWER))
+		iplc_sim_region_finalize();
+	if(page_policy != PAGE_NONE && STAT_ON(STATS_PAGES))
+		iplc_sim_page_finalize();
+	if(STAT_ON(STATS_CORE)){
+		printf("Pipeline Performance \n");
+		iplc_sim_stat_print(SECTION_PIPELINE, 0, NULL);
+		printf("\n");
+	}
+	if(show_latency && STAT_ON(STATS_LATENCY))
+		iplc_sim_latency_finalize();
+	if(stat_json)
+		iplc_sim_stat_dump(stat_json);
+
+	if(diff_cache.sets)
+		iplc_sim_diff_finalize();
 }
 
+/* Live statistics */
+
+/*
+ * Create the statistics page at path, which a viewer can map while the
+ * simulation runs; see iplc-stats.h.  It names every element of the
+ * enabled scalars and vectors in the registry.
+ */
 void
-iplc_sim_process_pipeline_lw(int dest_reg, int base_reg, uint data_address)
+iplc_sim_stats_open(char *path)
 {
-	iplc_sim_push_pipeline_stage();
+	int fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	int i, k, n = 0;
 
-	pipeline[FETCH].itype = LW;
-	pipeline[FETCH].instruction_address = instruction_address;
+	if(fd < 0 || ftruncate(fd, sizeof(iplc_stats_t)) < 0){
+		printf("open failed for %s file\n", path);
+		exit(-1);
+	}
+	stats_page = (iplc_stats_t*) mmap(NULL, sizeof(iplc_stats_t), PROT_READ|PROT_WRITE,
+									  MAP_SHARED, fd, 0);
+	close(fd);
+	if(stats_page == MAP_FAILED){
+		perror("mmap");
+		exit(-1);
+	}
+	memcpy(stats_page->magic, IPLC_STATS_MAGIC, sizeof(stats_page->magic));
+	stats_page->version = IPLC_STATS_VERSION;
+	stats_page->pid = getpid();
+	for(i = 0; i < sizeof(stat_registry) / sizeof(statistic_t); i++){
+		statistic_t *st = &stat_registry[i];
 
-	pipeline[FETCH].stage.lw.dest_reg = dest_reg;
-	pipeline[FETCH].stage.lw.base_reg = base_reg;
+		if((st->kind != STAT_SCALAR && st->kind != STAT_VECTOR) || !STAT_ON(st->group))
+			continue;
+		for(k = 0; k < iplc_sim_stat_length(st); k++){
+			if(n == IPLC_STATS_ENTRIES){
+				printf("Too many statistics for the page; raise IPLC_STATS_ENTRIES \n");
+				exit(-1);
+			}
+			if(st->kind == STAT_VECTOR)
+				snprintf(stats_page->entry[n].name, IPLC_STATS_NAME, "%s[%d]", st->name, k);
+			else
+				snprintf(stats_page->entry[n].name, IPLC_STATS_NAME, "%s", st->name);
+			stats_slot[n] = st;
+			stats_element[n++] = k;
+		}
+	}
+	stats_page->nentries = n;
+	iplc_sim_stats_publish(0);
+}
+
+/* Copy the counters to the statistics page; done if they are final. */
+void
+iplc_sim_stats_publish(int done)
+{
+	iplc_stats_t *p = stats_page;
+	uint seq = p->seq;
+	int i;
+
+	__atomic_store_n(&p->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	p->done = done;
+	for(i = 0; i < p->nentries; i++)
+		p->entry[i].value = iplc_sim_stat_value(stats_slot[i], stats_element[i]);
+	__atomic_store_n(&p->seq, seq + 2, __ATOMIC_RELEASE);
+	stats_left = STATS_PERIOD;
+}
+
+/* n more instructions have been issued; publish if it is time. */
+static void
+stats_tick(long n)
+{
+	if(stats_page && (stats_left -= n) <= 0)
+		iplc_sim_stats_publish(0);
+}
+
+/* Lower hierarchy and miss streams */
+
+/*
+ * Bytes of arena the levels below the cache take.
+ */
+size_t
+iplc_sim_lower_bytes()
+{
+	size_t bytes = 0;
+	int level;
+
+	for(level = 0; level < nlower; level++)
+		bytes += iplc_sim_cache_bytes(lower_config[level].sets, lower_config[level].assoc);
+	return bytes;
+}
+
+/*
+ * Build the levels below the cache, empty, out of arena a.
+ */
+void
+iplc_sim_lower_init(arena_t *a)
+{
+	int level;
+
+	for(level = 0; level < nlower; level++){
+		level_config_t *l = &lower_config[level];
+
+		iplc_sim_cache_init(&lower[level], a, l->sets, l->blocksize, l->assoc);
+		lower[level].policy = cache_policy;
+	}
+	memory_access = 0;
+}
+
+/*
+ * An access that missed in the level above, or a block written back from
+ * it, arrives at lower[level].  Returns the cycles until the data is back
+ * in the cache: the latency of the first level that hits, or
+ * memory_latency.  Writebacks allocate where they land and their latency
+ * is hidden by a write buffer.  Levels are not inclusive, and a lower
+ * level's blocks are assumed at least as big as the blocks above it.
+ * The block belongs to address space asid, which for a writeback need
+ * not be the running program's.
+ */
+int
+iplc_sim_lower_access(int level, uint address, int type, uint asid)
+{
+	for(; level < nlower; level++){
+		cache_t *c = &lower[level];
+		uint running = c->asid;
+		int hit;
+
+		c->asid = asid;
+		hit = iplc_sim_cache_lookup(c, address, type == ACCESS_WRITEBACK);
+		c->asid = running;
+		if(c->victim_dirty)
+			iplc_sim_lower_access(level+1, c->victim, ACCESS_WRITEBACK, c->victim_asid);
+		if(hit){
+			if(type != ACCESS_WRITEBACK)
+				lower_served = level + 1;
+			return lower_config[level].latency;
+		}
+		if(type == ACCESS_WRITEBACK)
+			return 0;
+	}
+	memory_access++;
+	if(type != ACCESS_WRITEBACK)
+		lower_served = OUTCOME_MEMORY;
+	return memory_latency;
+}
+
+static char *fill_order_names[] = {"whole", "early", "cwf"};
+
+/*
+ * Parse -C's words,cycles[,whole|early|cwf] into the fill globals;
+ * -1 if it is not that.
+ */
+int
+iplc_sim_parse_fill(char *s)
+{
+	char order[16];
+	int n = sscanf(s, "%d,%d,%15s", &beat_words, &beat_cycles, order), i;
+
+	if(n < 1 || beat_words <= 0 || (beat_words & (beat_words-1)) || (n >= 2 && beat_cycles <= 0))
+		return -1;
+	if(n < 2)
+		beat_cycles = 1;
+	if(n < 3)
+		return 0;
+	for(i = FILL_WHOLE; i <= FILL_CWF; i++)
+		if(strcmp(order, fill_order_names[i]) == 0){
+			fill_order = i;
+			return 0;
+		}
+	return -1;
+}
+
+/*
+ * Cycles until the word at address is back, given the latency the
+ * lookup alone would take, when a fill brings a block beat_words at a
+ * time, beat_cycles apart, after the latency of the level that had it.
+ * A miss waits for the last fill's beats to finish, then for its own
+ * up to the beat with its word: the first under critical word first,
+ * its place in the block in order under early restart, and the last
+ * under whole.  The rest of the fill arrives behind the restart, and a
+ * hit on it before its word is in waits for that word.
+ */
+int
+iplc_sim_fill_latency(uint address, int hit, int latency)
+{
+	uint now = pipeline_cycles, start, ready;
+	uint block = address >> cache.blockoffsetbits;
+	int beats = (cache.blocksize + beat_words - 1) / beat_words;
+	int beat = ((address >> 2) & (cache.blocksize - 1)) / beat_words;
+
+	if(hit){
+		if(!fill.valid || fill.block != block)
+			return latency;
+		ready = fill.first + ((beat - fill.critical + beats) % beats) * beat_cycles;
+		return ready > now + latency ? ready - now : latency;
+	}
+
+	start = now > fill_bus_free ? now : fill_bus_free;
+	fill.valid = 1;
+	fill.block = block;
+	fill.first = start + latency;
+	fill.critical = fill_order == FILL_CWF ? beat : 0;
+	fill_bus_free = fill.first + (beats - 1) * beat_cycles;
+	switch(fill_order){
+	case FILL_WHOLE:
+		ready = fill_bus_free;
+		break;
+	case FILL_EARLY:
+		ready = fill.first + beat * beat_cycles;
+		break;
+	default:
+		ready = fill.first;
+	}
+	return ready - now;
+}
+
+static char *region_kind_names[] = {"scratch", "uncached"};
+
+/*
+ * Parse one -A base,size,latency[,scratch|uncached] into region[],
+ * keeping it sorted; -1 if it is not that or overlaps one already there.
+ */
+int
+iplc_sim_parse_region(char *s)
+{
+	long long base, size;
+	int latency, n, i, kind = REGION_SCRATCH;
+	char name[16];
+
+	n = sscanf(s, "%lli,%lli,%d,%15s", &base, &size, &latency, name);
+	if(n < 3 || nregions == MAX_REGIONS || base < 0 || size <= 0 || base + size > 1ll << 32 ||
+	   latency <= 0)
+		return -1;
+	if(n == 4){
+		for(kind = REGION_SCRATCH; kind <= REGION_UNCACHED; kind++)
+			if(strcmp(name, region_kind_names[kind]) == 0)
+				break;
+		if(kind > REGION_UNCACHED)
+			return -1;
+	}
+	for(i = nregions; i > 0 && region[i-1].base > base; i--)
+		region[i] = region[i-1];
+	if((i > 0 && region[i-1].base + (long long)region[i-1].size > base) ||
+	   (i < nregions && base + size > region[i+1].base)){
+		for(; i < nregions; i++)
+			region[i] = region[i+1];
+		return -1;
+	}
+	region[i].base = base;
+	region[i].size = size;
+	region[i].latency = latency;
+	region[i].kind = kind;
+	region[i].access = 0;
+	nregions++;
+	return 0;
+}
+
+/*
+ * The region address is in, or NULL.  Regions are looked up by the
+ * address the program uses, before any page mapping.
+ */
+region_t *
+iplc_sim_region_find(uint address)
+{
+	int lo = 0, hi = nregions;
+
+	/* the last region starting at or before address is the only one it can be in */
+	while(lo < hi){
+		int mid = (lo + hi) / 2;
+
+		if(region[mid].base <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo > 0 && address - region[lo-1].base < region[lo-1].size)
+		return &region[lo-1];
+	return NULL;
+}
+
+void
+iplc_sim_region_finalize()
+{
+	int i;
+
+	for(i = 0; i < nregions; i++){
+		printf(" Address Region 0x%08x-0x%08x (%s, Latency %d) \n", region[i].base,
+			   region[i].base + region[i].size - 1, region_kind_names[region[i].kind],
+			   region[i].latency);
+		iplc_sim_stat_print(SECTION_REGION, i, NULL);
+		printf("\n");
+	}
+}
+
+void
+iplc_sim_lower_finalize()
+{
+	int level;
+
+	for(level = 0; level < nlower; level++){
+		cache_t *c = &lower[level];
+
+		if(c->setmul)
+			printf(" L%d Cache Performance (Sets %u, BlockSize %d, Assoc %d, Latency %d, %ld Bytes) \n",
+				   level+2, c->nsets, c->blocksize, c->assoc, lower_config[level].latency, c->capacity);
+		else
+			printf(" L%d Cache Performance (Index %d, BlockSize %d, Assoc %d, Latency %d) \n", level+2,
+				   c->index, c->blocksize, c->assoc, lower_config[level].latency);
+		iplc_sim_stat_print(SECTION_LOWER, level, NULL);
+		printf("\n");
+	}
+	printf(" Memory Performance (Latency %d) \n", memory_latency);
+	iplc_sim_stat_print(SECTION_MEMORY, 0, NULL);
+	printf("\n");
+}
+
+/*
+ * A miss stream file is an 8 byte magic, the cache's sets, blocksize,
+ * assoc and policy as 32-bit little-endian words, then one 13 byte
+ * record per L1 miss or writeback: type, address, pc and cycle, the last
+ * three 32-bit little-endian.
+ */
+static byte miss_stream_magic[8] = "IPLCMS02";
+static byte strip_magic[8] = "IPLCST01";
+
+static void
+put32(byte *p, uint v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint
+get32(byte *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+/*
+ * Record every L1 miss and writeback of this run in path.  Must follow
+ * iplc_sim_init, whose configuration goes in the header.
+ */
+void
+iplc_sim_miss_stream_open(char *path)
+{
+	byte hdr[24];
+
+	if((miss_stream = fopen(path, "wb")) == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	memcpy(hdr, miss_stream_magic, 8);
+	put32(hdr+8, cache.nsets);
+	put32(hdr+12, cache.blocksize);
+	put32(hdr+16, cache.assoc);
+	put32(hdr+20, cache.policy);
+	fwrite(hdr, 1, sizeof(hdr), miss_stream);
+}
+
+void
+iplc_sim_miss_stream_record(int type, uint address, uint pc)
+{
+	byte rec[13];
+
+	if(strip_stream && type == ACCESS_WRITEBACK)
+		return;
+	rec[0] = type;
+	put32(rec+1, address);
+	put32(rec+5, pc);
+	put32(rec+9, strip_stream ? cache.access - 1 : pipeline_cycles);
+	fwrite(rec, 1, sizeof(rec), miss_stream);
+}
+
+/*
+ * Run a recorded miss stream through the levels below the cache alone,
+ * without the trace, the pipeline or the cache it was recorded under.
+ */
+void
+iplc_sim_miss_stream_replay(char *path)
+{
+	FILE *f = fopen(path, "rb");
+	byte hdr[24], rec[13];
+	long misses = 0, writebacks = 0, latency = 0;
+
+	if(f == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	if(fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)){
+		printf("%s is not a miss stream \n", path);
+		exit(-1);
+	}
+	if(memcmp(hdr, strip_magic, 8) == 0){
+		iplc_sim_strip_replay(f, hdr, path);
+		fclose(f);
+		return;
+	}
+	if(memcmp(hdr, miss_stream_magic, 8) != 0){
+		printf("%s is not a miss stream \n", path);
+		exit(-1);
+	}
+	iplc_sim_arena_reserve(&arena, iplc_sim_lower_bytes());
+	iplc_sim_lower_init(&arena);
+
+	while(fread(rec, 1, sizeof(rec), f) == sizeof(rec)){
+		if(rec[0] == ACCESS_WRITEBACK){
+			writebacks++;
+			iplc_sim_lower_access(0, get32(rec+1), ACCESS_WRITEBACK, 0);
+		}else{
+			misses++;
+			latency += iplc_sim_lower_access(0, get32(rec+1), rec[0], 0);
+		}
+	}
+	fclose(f);
+
+	printf("Miss Stream Replay \n");
+	printf("\t Recorded under Sets %u, BlockSize %u, Assoc %u \n",
+		   get32(hdr+8), get32(hdr+12), get32(hdr+16));
+	printf("\t Number of L1 Misses is %ld \n", misses);
+	printf("\t Number of L1 Writebacks is %ld \n", writebacks);
+	printf("\t Average L1 Miss Latency is %f \n\n", misses ? (double)latency / (double)misses : 0);
+	iplc_sim_lower_finalize();
+}
+
+/* Address translation */
+
+static char *page_policy_names[] = {"none", "sequential", "random", "binhop", "color"};
+
+/*
+ * Parse a page allocation policy name; -1 if unknown.
+ */
+int
+iplc_sim_parse_page_policy(char *s)
+{
+	int i;
+
+	for(i = PAGE_SEQUENTIAL; i <= PAGE_COLOR; i++)
+		if(strcmp(s, page_policy_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/* Colors a physically indexed cache c needs: the frames one way spans. */
+static uint
+page_colors_of(cache_t *c)
+{
+	uint way = c->nsets << c->blockoffsetbits;
+
+	return way > page_size ? way / page_size : 1;
+}
+
+/*
+ * Empty the page table, for a run over the caches iplc_sim_init just
+ * built.  The colors are those of the biggest physically indexed way,
+ * so coloring and bin hopping spread pages over every level's sets.
+ */
+void
+iplc_sim_page_init()
+{
+	int level;
+	uint colors;
+
+	page_shift = (int) rint((log( (double) page_size )/ log(2)));
+	if(cache.blocksize * 4 > page_size){
+		printf("Page size %u is smaller than a block \n", page_size);
+		exit(-1);
+	}
+	page_colors = page_virtual_l1 ? 1 : page_colors_of(&cache);
+	for(level = 0; level < nlower; level++){
+		if(lower[level].blocksize * 4 > page_size){
+			printf("Page size %u is smaller than a block of L%d \n", page_size, level+2);
+			exit(-1);
+		}
+		if((colors = page_colors_of(&lower[level])) > page_colors)
+			page_colors = colors;
+	}
+
+	free(pages);
+	pages_size = 1024;
+	pages_used = 0;
+	pages = (page_t*) calloc(pages_size, sizeof(page_t));
+	free(page_next);
+	page_next = (uint*) calloc(page_colors, sizeof(uint));
+	/* the same size every run; only clear it again */
+	if(page_policy == PAGE_RANDOM){
+		size_t bytes = ((1ul << (32 - page_shift)) + 7) / 8;
+
+		if(page_taken)
+			memset(page_taken, 0, bytes);
+		else
+			page_taken = (byte*) calloc(bytes, 1);
+	}
+	page_frame = 0;
+	page_seed = 1;
+
+	if(verbose)
+		printf("   Pages: %s, %u bytes, %u colors%s \n", page_policy_names[page_policy],
+			   page_size, page_colors, page_virtual_l1 ? ", virtually indexed" : "");
+}
+
+/* xorshift, apart from mix_random so mixing does not move frames */
+static uint
+page_random()
+{
+	page_seed ^= page_seed << 13;
+	page_seed ^= page_seed >> 17;
+	page_seed ^= page_seed << 5;
+	return page_seed;
+}
+
+/* A free frame for virtual page vpn, by page_policy. */
+static uint
+page_alloc(uint vpn)
+{
+	uint frames = 1u << (32 - page_shift);
+	uint color, pfn;
+	int draws;
+
+	if(pages_used >= (long)frames){
+		printf("Out of physical memory after %ld pages \n", pages_used);
+		exit(-1);
+	}
+	switch(page_policy){
+	case PAGE_SEQUENTIAL:
+		return page_frame++;
+	case PAGE_RANDOM:
+		/* memory nearly full takes too many draws; scan on from the last */
+		pfn = page_random() & (frames - 1);
+		for(draws = 1; page_taken[pfn >> 3] & (1 << (pfn & 7)); draws++)
+			pfn = draws < PAGE_DRAWS ? page_random() & (frames - 1) : (pfn + 1) & (frames - 1);
+		page_taken[pfn >> 3] |= 1 << (pfn & 7);
+		return pfn;
+	case PAGE_BINHOP:
+		/* consecutive faults go to consecutive colors */
+		color = page_frame++ % page_colors;
+		break;
+	default:
+		/* the frame keeps the page's virtual color */
+		color = vpn % page_colors;
+		break;
+	}
+	if(page_next[color] >= frames / page_colors){
+		printf("Out of physical memory of color %u \n", color);
+		exit(-1);
+	}
+	return color + page_next[color]++ * page_colors;
+}
+
+/*
+ * The physical address of address in address space asid, mapping its
+ * page on first touch.
+ */
+uint
+iplc_sim_translate(uint asid, uint address)
+{
+	uint vpn = address >> page_shift;
+	long i;
+
+	for(i = (vpn ^ asid * 0x9e3779b9u) & (pages_size-1); pages[i].used; i = (i+1) & (pages_size-1))
+		if(pages[i].vpn == vpn && pages[i].asid == asid)
+			return (pages[i].pfn << page_shift) | (address & (page_size-1));
+
+	if(2 * (pages_used + 1) > pages_size){
+		page_t *old = pages;
+		long n = pages_size, j;
+
+		pages_size *= 2;
+		pages = (page_t*) calloc(pages_size, sizeof(page_t));
+		for(j = 0; j < n; j++)
+			if(old[j].used){
+				for(i = (old[j].vpn ^ old[j].asid * 0x9e3779b9u) & (pages_size-1); pages[i].used;
+					i = (i+1) & (pages_size-1))
+					;
+				pages[i] = old[j];
+			}
+		free(old);
+		for(i = (vpn ^ asid * 0x9e3779b9u) & (pages_size-1); pages[i].used; i = (i+1) & (pages_size-1))
+			;
+	}
+	pages[i].used = 1;
+	pages[i].asid = asid;
+	pages[i].vpn = vpn;
+	pages[i].pfn = page_alloc(vpn);
+	pages_used++;
+	return (pages[i].pfn << page_shift) | (address & (page_size-1));
+}
+
+void
+iplc_sim_page_finalize()
+{
+	printf(" Page Mapping (%s) \n", page_policy_names[page_policy]);
+	iplc_sim_stat_print(SECTION_PAGES, 0, NULL);
+	printf("\n");
+}
+
+/* Pipeline Functions  */
+/*
+ * Dump the current contents of our pipeline.
+ */
+void
+iplc_sim_dump_pipeline()
+{
+	int i;
+	
+	for(i = 0; i < MAX_STAGES; i++){
+		uint iaddr = pipeline[i].instruction_address;
+		switch(i){
+		case FETCH:
+			printf("(cyc: %u) FETCH:\t %d: 0x%x \t", pipeline_cycles, pipeline[i].itype, iaddr);
+			break;
+		case DECODE:
+			printf("DECODE:\t %d: 0x%x \t", pipeline[i].itype, iaddr);
+			break;
+		case ALU:
+			printf("ALU:\t %d: 0x%x \t", pipeline[i].itype, iaddr);
+			break;
+		case MEM:
+			printf("MEM:\t %d: 0x%x \t", pipeline[i].itype, iaddr);
+			break;
+		case WRITEBACK:
+			printf("WB:\t %d: 0x%x \n", pipeline[i].itype, iaddr);
+			break;
+		default:
+			printf("DUMP: Bad stage!\n" );
+			exit(-1);
+		}
+	}
+}
+
+/* test the given instruction to see if it's immeadiate */
+int
+immeadiate_instruction_p(const char *instr)
+{
+	return strncmp(instr, "addi", 4) != 0
+		&& strncmp(instr, "ori", 3) != 0
+		&& strncmp(instr, "sll", 3) != 0;
+}
+
+
+/* Pipeline timeline */
+
+static char *timeline_stages[MAX_STAGES] = {"FETCH", "DECODE", "ALU", "MEM", "WB"};
+
+enum {TIMELINE_STALLS = MAX_STAGES};    /* the track stall spans go on */
+
+static int
+timeline_in_window(long seq)
+{
+	return seq >= timeline_first && seq < timeline_first + timeline_count;
+}
+
+static void
+timeline_event(char *cat, int tid, uint start, uint end, char *name, long seq, uint pc)
+{
+	fprintf(timeline, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,"
+			"\"pid\":1,\"tid\":%d", timeline_events++ ? ",\n" : "", name, cat, start,
+			end - start, tid);
+	if(seq >= 0)
+		fprintf(timeline, ",\"args\":{\"seq\":%ld,\"pc\":\"0x%x\"}", seq, pc);
+	fprintf(timeline, "}");
+}
+
+/* What to call the instruction in p. */
+static char *
+timeline_name(pipeline_t *p)
+{
+	switch(p->itype){
+	case RTYPE:
+		return (char*) p->stage.rtype.instruction;
+	case JUMP:
+	case JAL:
+		return (char*) p->stage.jump.instruction;
+	case LW:
+		return "lw";
+	case SW:
+		return "sw";
+	case BRANCH:
+		return "branch";
+	case SYSCALL:
+		return "syscall";
+	default:
+		return "nop";
+	}
+}
+
+/*
+ * Write a Chrome trace-event timeline of count instructions from the
+ * first'th issued to path: a track per stage with a span for each
+ * instruction as long as it sits there, and a track of stalls and
+ * their causes.  One cycle is shown as one microsecond.  Once the window
+ * has drained from the pipeline the file is finished and closed.
+ */
+void
+iplc_sim_timeline_open(char *path, long first, long count)
+{
+	int s;
+
+	if((timeline = fopen(path, "w")) == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	setvbuf(timeline, NULL, _IOFBF, 1 << 20);
+	timeline_first = first;
+	timeline_count = count;
+	timeline_issued = 0;
+	timeline_pushed = pipeline_cycles;
+	for(s = 0; s < MAX_STAGES; s++)
+		timeline_seq[s] = -1;
+	fprintf(timeline, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(timeline, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"iplc-sim\"}}");
+	for(s = 0; s <= TIMELINE_STALLS; s++)
+		fprintf(timeline, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				"\"args\":{\"name\":\"%s\"}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\","
+				"\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", s,
+				s < MAX_STAGES ? timeline_stages[s] : "Stalls", s, s);
+	timeline_events = 1;
+}
+
+/*
+ * The push just made took cycles, for cause if more than one: close the
+ * span of every stage's instruction in the window, which moves on now.
+ */
+void
+iplc_sim_timeline_push(int cycles, char *cause)
+{
+	int s, any = 0;
+
+	for(s = 0; s < MAX_STAGES; s++){
+		pipeline_t *p = &pipeline[s];
+
+		if(!timeline_in_window(timeline_seq[s]) || p->instruction_address == 0)
+			continue;
+		any = 1;
+		timeline_event("stage", s, timeline_pushed, pipeline_cycles,
+					   timeline_name(p), timeline_seq[s], p->instruction_address);
+	}
+	if(any && cycles > 1)
+		timeline_event("stall", TIMELINE_STALLS, pipeline_cycles - (cycles - 1), pipeline_cycles,
+					   cause, -1, 0);
+	for(s = WRITEBACK; s > FETCH; s--)
+		timeline_seq[s] = timeline_seq[s-1];
+	timeline_seq[FETCH] = -1;
+	timeline_push_began = pipeline_cycles - cycles;
+	timeline_pushed = pipeline_cycles;
+	if(timeline_issued >= timeline_first + timeline_count && !timeline_in_window(timeline_seq[WRITEBACK]) &&
+	   !timeline_in_window(timeline_seq[MEM]) && !timeline_in_window(timeline_seq[ALU]) &&
+	   !timeline_in_window(timeline_seq[DECODE]))
+		iplc_sim_timeline_close();
+}
+
+/*
+ * An instruction has just been put in FETCH, its fetch having hit or
+ * not; a miss kept it out from when its fetch began to the push that
+ * put it there.
+ */
+void
+iplc_sim_timeline_issue(int instruction_hit)
+{
+	long seq = timeline_issued++;
+
+	timeline_seq[FETCH] = seq;
+	if(!instruction_hit && timeline_in_window(seq) && timeline_push_began > pipeline[FETCH].fetched)
+		timeline_event("stall", TIMELINE_STALLS, pipeline[FETCH].fetched, timeline_push_began,
+					   "instruction miss", -1, 0);
+}
+
+void
+iplc_sim_timeline_close()
+{
+	fprintf(timeline, "\n]}\n");
+	fclose(timeline);
+	timeline = NULL;
+}
+
+/*
+ * Check if various stages of our pipeline require stalls, forwarding, etc.
+ * Then push the contents of our various pipeline stages through the pipeline.
+ * record cycle count, correct branch predictions, and other data in execution.
+ */
+void
+iplc_sim_push_pipeline_stage()
+{
+	int i;
+	int data_hit=1;
+	int mem_cycles=1;
+	int cycle_count=1;
+	int branch=0;   /* 1 + whether the branch in DECODE was taken, if there is one */
+	
+	/* 1. Count WRITEBACK stage is "retired" -- This I'm giving you */
+	if(pipeline[WRITEBACK].instruction_address){
+		instruction_count++;
+		if(STAT_ON(STATS_LATENCY))
+			iplc_sim_hist_add(&retire_latency, pipeline_cycles - pipeline[WRITEBACK].fetched);
+		if(debug)
+			printf("DEBUG: Retired Instruction at 0x%x, Type %d, at Time %u \n",
+				   pipeline[WRITEBACK].instruction_address, pipeline[WRITEBACK].itype, pipeline_cycles);
+	}
+	
+	/* 2. Check for BRANCH and correct/incorrect Branch Prediction */
+	if(pipeline[DECODE].itype == BRANCH){
+		int branch_taken =
+			(pipeline[FETCH].instruction_address != pipeline[DECODE].instruction_address + 4) && (pipeline[FETCH].itype != NOP);
+		if(branch_taken == 1 && verbose){
+			printf("DEBUG: Branch Taken: FETCH addr = 0x%x, DECODE instr addr = 0x%x \n",
+					pipeline[FETCH].instruction_address, pipeline[DECODE].instruction_address);
+		}
+		branch = 1 + branch_taken;
+		if (branch_taken == branch_predict_taken){
+			correct_branch_predictions++;
+			// if (debug)
+				
+		}else{
+			cycle_count = 1 + BRANCH_PENALTY;
+		}
+		
+	}
+	
+	switch(pipeline[MEM].itype){
+	/* 3. Check for LW delays due to use in ALU stage and if data hit/miss
+	 *	add delay cycles if needed.
+	 */
+	case LW:
+		data_hit = iplc_sim_trap_address(pipeline[MEM].stage.lw.data_address,
+										 pipeline[MEM].stage.lw.size, ACCESS_LOAD,
+										 pipeline[MEM].instruction_address, &mem_cycles);
+		if(mem_cycles > cycle_count)
+			cycle_count = mem_cycles;
+		if(!data_hit){
+			if(verbose)
+				printf("DATA MISS:\t Address 0x%x\n", pipeline[MEM].stage.lw.data_address);
+		}else if(verbose){
+			printf("DATA HIT:\t Address 0x%x\n", pipeline[MEM].stage.lw.data_address);
+		}
+		break;
+	/* 4. Check for SW mem access and data miss .. add delay cycles if needed */
+	case SW:
+		data_hit = iplc_sim_trap_address(pipeline[MEM].stage.sw.data_address,
+										 pipeline[MEM].stage.sw.size, ACCESS_STORE,
+										 pipeline[MEM].instruction_address, &mem_cycles);
+		if(mem_cycles > cycle_count)
+			cycle_count = mem_cycles;
+		if(!data_hit){
+			if(verbose)
+				printf("DATA MISS:\t Address 0x%x\n", pipeline[MEM].stage.sw.data_address);
+		}else if(verbose){
+			printf("DATA HIT:\t Address 0x%x\n", pipeline[MEM].stage.sw.data_address);
+		}
+		break;
+	}
+	
+	/* 5. Increment pipe_cycles 1 cycle for normal processing */
+	pipeline_cycles += cycle_count;
+	if(outcomes)
+		iplc_sim_outcome_push(branch, pipeline[MEM].itype == LW || pipeline[MEM].itype == SW);
+	if(timeline)
+		iplc_sim_timeline_push(cycle_count, mem_cycles == cycle_count ?
+							   (data_hit ? "slow data access" : "data miss") : "branch mispredict");
+
+	/* 6. push stages thru MEM->WB, ALU->MEM, DECODE->ALU, FETCH->DECODE */
+	pipeline[WRITEBACK] = pipeline[MEM];
+	pipeline[MEM] = pipeline[ALU];
+	pipeline[ALU] = pipeline[DECODE];
+	pipeline[DECODE] = pipeline[FETCH];
+	
+	/* Reset the FETCH stage to NOP via bezero */
+	bzero(&(pipeline[FETCH]), sizeof(pipeline_t));
+}
+
+/*
+ * Each of the iplc_sim_process_pipeline_* functions
+ * prepares the fetch stage of our pipeline with the
+ * instructions sent from iplc_sim_parse_instruction
+ */
+
+void
+iplc_sim_process_pipeline_rtype(byte *instruction, int dest_reg, int reg1, int reg2_or_constant)
+{
+	iplc_sim_push_pipeline_stage();
+	
+	pipeline[FETCH].itype = RTYPE;
+	pipeline[FETCH].instruction_address = instruction_address;
+	
+	strcpy(pipeline[FETCH].stage.rtype.instruction, instruction);
+	pipeline[FETCH].stage.rtype.reg1 = reg1;
+	pipeline[FETCH].stage.rtype.reg2_or_constant = reg2_or_constant;
+	pipeline[FETCH].stage.rtype.dest_reg = dest_reg;
+}
+
+void
+iplc_sim_process_pipeline_lw(int dest_reg, int base_reg, uint data_address, int size)
+{
+	iplc_sim_push_pipeline_stage();
+
+	pipeline[FETCH].itype = LW;
+	pipeline[FETCH].instruction_address = instruction_address;
+
+	pipeline[FETCH].stage.lw.dest_reg = dest_reg;
+	pipeline[FETCH].stage.lw.base_reg = base_reg;
 	pipeline[FETCH].stage.lw.data_address = data_address;
+	pipeline[FETCH].stage.lw.size = size;
+}
+
+void
+iplc_sim_process_pipeline_sw(int src_reg, int base_reg, uint data_address, int size)
+{
+	iplc_sim_push_pipeline_stage();
+
+	pipeline[FETCH].itype = SW;
+	pipeline[FETCH].instruction_address = instruction_address;
+	
+	pipeline[FETCH].stage.sw.src_reg = src_reg;
+	pipeline[FETCH].stage.sw.base_reg = base_reg;
+	pipeline[FETCH].stage.sw.data_address = data_address;
+	pipeline[FETCH].stage.sw.size = size;
+}
+
+void
+iplc_sim_process_pipeline_branch(int reg1, int reg2)
+{
+	iplc_sim_push_pipeline_stage();
+
+	pipeline[FETCH].itype = BRANCH;
+	pipeline[FETCH].instruction_address = instruction_address;
+	branch_count++;
+
+	pipeline[FETCH].stage.branch.reg1 = reg1;
+	pipeline[FETCH].stage.branch.reg2 = reg2;
+}
+
+void
+iplc_sim_process_pipeline_jump(byte *instruction)
+{
+	iplc_sim_push_pipeline_stage();
+
+	/* handle both jump instructions */
+	pipeline[FETCH].itype = (strncmp(instruction, "jal", 3) == 0) ? JAL : JUMP;
+	pipeline[FETCH].instruction_address = instruction_address;
+
+	strcpy(pipeline[FETCH].stage.jump.instruction, instruction);
+}
+
+void
+iplc_sim_process_pipeline_syscall()
+{
+	iplc_sim_push_pipeline_stage();
+
+	pipeline[FETCH].itype = SYSCALL;
+	pipeline[FETCH].instruction_address = instruction_address;
+}
+
+void
+iplc_sim_process_pipeline_nop()
+{
+	iplc_sim_push_pipeline_stage();
+	/*
+	pipeline[FETCH] already set to NOP,
+	since it's zeroed out in iplc_sim_push_pipeline_stage.
+	*/
+}
+
+/* parse functions  */
+
+/*
+ * Don't touch this function.  It is for parsing the instruction stream.
+ */
+uint
+iplc_sim_parse_reg(byte *reg_str)
+{
+	int i;
+	// turn comma into \n
+	if (reg_str[strlen(reg_str)-1] == ',')
+		reg_str[strlen(reg_str)-1] = '\n';
+	
+	if (reg_str[0] != '$')
+		return atoi(reg_str);
+	else {
+		// copy down over $ byteacter than return atoi
+		for (i = 0; i < strlen(reg_str); i++)
+			reg_str[i] = reg_str[i+1];
+		
+		return atoi(reg_str);
+	}
+}
+
+/*
+ * Bytes accessed by the load or store named instruction; 0 if it is not one.
+ */
+int
+iplc_sim_access_size(byte *instruction)
+{
+	int i;
+
+	for(i = 0; i < sizeof(memory_ops) / sizeof(memory_ops[0]); i++)
+		if(strcmp((char*) instruction, memory_ops[i].name) == 0)
+			return memory_ops[i].size;
+	return 0;
+}
+
+/*
+ * Don't touch this function.  It is for parsing the instruction stream.
+ * Decodes one line of the trace into insn without touching the simulator.
+ */
+void
+iplc_sim_decode_instruction(byte *buffer, insn_t *insn)
+{
+	byte str_src_reg[16];
+	byte str_src_reg2[16];
+	byte str_dest_reg[16];
+	byte str_constant[16];
+	
+	memset(insn, 0, sizeof(insn_t));
+	if (sscanf(buffer, "%x %s", &instruction_address, instruction ) != 2) {
+		printf("Malformed instruction \n");
+		exit(-1);
+	}
+	insn->instruction_address = instruction_address;
+	strcpy((char*) insn->instruction, (char*) instruction);
+	
+	// Parse the Instruction
+	
+	if (strncmp( instruction, "add", 3 ) == 0 ||
+		strncmp( instruction, "sll", 3 ) == 0 ||
+		strncmp( instruction, "ori", 3 ) == 0) {
+		if (sscanf(buffer, "%x %s %s %s %s",
+				   &instruction_address,
+				   instruction,
+				   str_dest_reg,
+				   str_src_reg,
+				   str_src_reg2 ) != 5) {
+			printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
+				   instruction, instruction_address);
+			exit(-1);
+		}
+		
+		insn->itype = RTYPE;
+		insn->dest_reg = iplc_sim_parse_reg(str_dest_reg);
+		insn->reg1 = iplc_sim_parse_reg(str_src_reg);
+		insn->reg2_or_constant = iplc_sim_parse_reg(str_src_reg2);
+	}
+	
+	else if (strncmp( instruction, "lui", 3 ) == 0) {
+		if (sscanf(buffer, "%x %s %s %s",
+				   &instruction_address,
+				   instruction,
+				   str_dest_reg,
+				   str_constant ) != 4 ) {
+			printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
+				   instruction, instruction_address );
+			exit(-1);
+		}
+		
+		insn->itype = RTYPE;
+		insn->dest_reg = iplc_sim_parse_reg(str_dest_reg);
+		insn->reg1 = -1;
+		insn->reg2_or_constant = -1;
+	}
+	
+	else if (strncmp( instruction, "lw", 2 ) == 0 ||
+			 strncmp( instruction, "sw", 2 ) == 0  ||
+			 iplc_sim_access_size( instruction ) != 0) {
+		if ( sscanf( buffer, "%x %s %s %s %x",
+					&instruction_address,
+					instruction,
+					reg1,
+					offsetwithreg,
+					&data_address ) != 5) {
+			printf("Bad instruction: %s at address %x \n", instruction, instruction_address);
+			exit(-1);
+		}
+		
+		// don't need to worry about base regs -- the pipeline gets -1 values
+		insn->data_address = data_address;
+		if ((insn->size = iplc_sim_access_size(instruction)) == 0)
+			insn->size = 4;
+		if (instruction[0] == 'l') {
+			insn->itype = LW;
+			insn->dest_reg = iplc_sim_parse_reg(reg1);
+		}
+		else {
+			insn->itype = SW;
+			insn->reg1 = iplc_sim_parse_reg(reg1);
+		}
+	}
+	else if (strncmp( instruction, "beq", 3 ) == 0) {
+		// don't need to worry about getting regs -- the pipeline gets -1 values
+		insn->itype = BRANCH;
+	}
+	else if (strncmp( instruction, "jal", 3 ) == 0 ||
+			 strncmp( instruction, "jr", 2 ) == 0 ||
+			 strncmp( instruction, "j", 1 ) == 0 ) {
+		/*
+		 * Note: no need to worry about forwarding on the jump register
+		 * we'll let that one go.
+		 */
+		insn->itype = JUMP;
+	}
+	else if ( strncmp( instruction, "syscall", 7 ) == 0) {
+		insn->itype = SYSCALL;
+	}
+	else if ( strncmp( instruction, "nop", 3 ) == 0) {
+		insn->itype = NOP;
+	}
+	else {
+		printf("Do not know how to process instruction: %s at address %x \n",
+			   instruction, instruction_address );
+		exit(-1);
+	}
+}
+
+static void issue_fetched(insn_t *insn, int instruction_hit, int latency);
+
+/*
+ * Fetch a decoded instruction through the cache and hand it to the
+ * pipeline.
+ */
+void
+iplc_sim_issue_instruction(insn_t *insn)
+{
+	int instruction_hit = 0;
+	int latency = 1;
+	
+	instruction_address = insn->instruction_address;
+	if(lock_markers)
+		iplc_sim_lock_marker(instruction_address);
+	if(insn->nofetch)
+		instruction_hit = 1;
+	else
+		instruction_hit = iplc_sim_trap_address( instruction_address, 4, ACCESS_IFETCH, instruction_address, &latency );
+	issue_fetched(insn, instruction_hit, latency);
+}
+
+/* The rest of issuing insn, once its fetch has hit or taken latency. */
+static void
+issue_fetched(insn_t *insn, int instruction_hit, int latency)
+{
+	int i=0, j=0;
+	uint fetched = pipeline_cycles;
+
+	// if a MISS, then push current instruction thru pipeline
+	// (or a hit on a block whose fill has not yet brought this word)
+	if(!instruction_hit || latency > 1){
+		// need to subtract 1, since the stage is pushed once more for actual instruction processing
+		// also need to allow for a branch miss prediction during the fetch cache miss time -- by
+		// counting cycles this allows for these cycles to overlap and not doubly count.
+		
+		if(verbose)
+			printf(instruction_hit ? "INST HIT:\t Address 0x%x \n" : "INST MISS:\t Address 0x%x \n",
+				   instruction_address);
+		if(outcomes)
+			iplc_sim_outcome_fetch();
+		
+		for (i = pipeline_cycles, j = pipeline_cycles; i < j + latency - 1; i++)
+			iplc_sim_push_pipeline_stage();
+	}
+	else if(verbose && !insn->nofetch)
+		printf("INST HIT:\t Address 0x%x \n", instruction_address);
+	
+	switch(insn->itype){
+	case RTYPE:
+		iplc_sim_process_pipeline_rtype(insn->instruction, insn->dest_reg,
+										insn->reg1, insn->reg2_or_constant);
+		break;
+	case LW:
+		iplc_sim_process_pipeline_lw(insn->dest_reg, -1, insn->data_address, insn->size);
+		break;
+	case SW:
+		iplc_sim_process_pipeline_sw(insn->reg1, -1, insn->data_address, insn->size);
+		break;
+	case BRANCH:
+		iplc_sim_process_pipeline_branch(-1, -1);
+		break;
+	case JUMP:
+	case JAL:
+		iplc_sim_process_pipeline_jump(insn->instruction);
+		break;
+	case SYSCALL:
+		iplc_sim_process_pipeline_syscall();
+		break;
+	case NOP:
+		iplc_sim_process_pipeline_nop();
+		break;
+	}
+	pipeline[FETCH].fetched = fetched;
+	if(timeline)
+		iplc_sim_timeline_issue(instruction_hit);
+}
+
+void
+iplc_sim_parse_instruction(byte *buffer)
+{
+	insn_t insn;
+
+	iplc_sim_decode_instruction(buffer, &insn);
+	iplc_sim_issue_instruction(&insn);
+}
+
+/* Neither a memory access nor a branch: pushing it past a stage costs a cycle. */
+static int
+steady_itype(int itype)
+{
+	return itype != LW && itype != SW && itype != BRANCH;
+}
+
+/* What the iplc_sim_process_pipeline_* function for insn puts in FETCH. */
+static void
+fetch_stage(pipeline_t *p, insn_t *insn)
+{
+	memset(p, 0, sizeof(pipeline_t));
+	switch(insn->itype){
+	case LW:
+		p->itype = LW;
+		p->stage.lw.dest_reg = insn->dest_reg;
+		p->stage.lw.base_reg = -1;
+		p->stage.lw.data_address = insn->data_address;
+		p->stage.lw.size = insn->size;
+		break;
+	case SW:
+		p->itype = SW;
+		p->stage.sw.src_reg = insn->reg1;
+		p->stage.sw.base_reg = -1;
+		p->stage.sw.data_address = insn->data_address;
+		p->stage.sw.size = insn->size;
+		break;
+	case BRANCH:
+		p->itype = BRANCH;
+		p->stage.branch.reg1 = -1;
+		p->stage.branch.reg2 = -1;
+		break;
+	case RTYPE:
+		p->itype = RTYPE;
+		strcpy((char*) p->stage.rtype.instruction, (char*) insn->instruction);
+		p->stage.rtype.reg1 = insn->reg1;
+		p->stage.rtype.reg2_or_constant = insn->reg2_or_constant;
+		p->stage.rtype.dest_reg = insn->dest_reg;
+		break;
+	case JUMP:
+	case JAL:
+		p->itype = (strncmp(insn->instruction, "jal", 3) == 0) ? JAL : JUMP;
+		strcpy((char*) p->stage.jump.instruction, (char*) insn->instruction);
+		break;
+	case SYSCALL:
+		p->itype = SYSCALL;
+		break;
+	default:
+		return;
+	}
+	p->instruction_address = insn->instruction_address;
+}
+
+/* Leave the pipeline as n pushes issuing trace[0..n) would. */
+static void
+advance_pipeline(insn_t *trace, long n)
+{
+	int s;
+
+	if(n <= 0)
+		return;
+	for(s = WRITEBACK; s >= n; s--)
+		pipeline[s] = pipeline[s - n];
+	for(s = 0; s < MAX_STAGES && s < n; s++)
+		fetch_stage(&pipeline[s], &trace[n - 1 - s]);    /* FETCH holds the last of them */
+	instruction_address = trace[n-1].instruction_address;
+}
+
+/*
+ * Issue the longest run at the start of trace, at most count long, that
+ * the pipeline can take at one cycle an instruction, and return how many
+ * were issued; 0 if the pipeline is not in that steady state.
+ *
+ * With no load, store or branch in the pipeline or the run, every push
+ * retires what is in WRITEBACK and costs exactly one cycle, so a run of
+ * n hitting fetches is n cycles and the retirements of the n oldest
+ * stages, and the pipeline ends up holding the last five instructions.
+ * The fetches themselves still go through the cache one by one, in
+ * order.  A fetch that misses, or takes longer than a cycle anyway,
+ * ends the run and is issued as usual.
+ */
+long
+iplc_sim_issue_steady(insn_t *trace, long count)
+{
+	long n, k;
+	int s, hit = 1, latency = 1;
+	/* a repeat fetch touches nothing but the cache itself */
+	int direct = !diff_cache.sets && page_policy == PAGE_NONE;
+
+	for(s = 0; s < MAX_STAGES; s++)
+		if(!steady_itype(pipeline[s].itype))
+			return 0;
+	/* shorter runs cost more to rebuild the pipeline after than to push */
+	for(n = 0; n < count && n < MAX_STAGES && steady_itype(trace[n].itype); n++)
+		;
+	if(n < MAX_STAGES)
+		return 0;
+	for(n = 0; n < count && steady_itype(trace[n].itype); n++){
+		if(trace[n].nofetch || (direct && iplc_sim_cache_refetch(&cache, trace[n].instruction_address)))
+			continue;
+		hit = iplc_sim_trap_address(trace[n].instruction_address, 4, ACCESS_IFETCH,
+									trace[n].instruction_address, &latency);
+		if(!hit || latency > 1)
+			break;
+	}
+	if(n == 0 && hit && latency == 1)
+		return 0;
+
+	/* the stages, oldest first, followed by the run, retire in turn, a cycle apart */
+	for(k = 0; k < n; k++)
+		if(k < MAX_STAGES ? pipeline[WRITEBACK - k].instruction_address != 0 :
+		   trace[k - MAX_STAGES].itype != NOP){
+			instruction_count++;
+			if(STAT_ON(STATS_LATENCY))
+				iplc_sim_hist_add(&retire_latency, k < MAX_STAGES ?
+								  pipeline_cycles + k - pipeline[WRITEBACK - k].fetched : MAX_STAGES);
+		}
+	pipeline_cycles += n;
+	advance_pipeline(trace, n);
+	for(s = 0; s < MAX_STAGES && s < n; s++)
+		pipeline[s].fetched = pipeline_cycles - 1 - s;
+
+	if(!hit || latency > 1){
+		instruction_address = trace[n].instruction_address;
+		issue_fetched(&trace[n], hit, latency);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * The load or store, if any, whose access the push issuing trace[k]
+ * makes: it sits in MEM then, four instructions back, in the pipeline
+ * as it stands for the first four.  *type and *address and *size get it.
+ */
+static int
+block_access(insn_t *trace, long k, int *type, uint *address, int *size, uint *pc)
+{
+	if(k < MAX_STAGES - 1){
+		pipeline_t *p = &pipeline[MEM - k];
+
+		if(p->itype == LW){
+			*address = p->stage.lw.data_address;
+			*size = p->stage.lw.size;
+		}else if(p->itype == SW){
+			*address = p->stage.sw.data_address;
+			*size = p->stage.sw.size;
+		}else
+			return 0;
+		*type = p->itype == LW ? ACCESS_LOAD : ACCESS_STORE;
+		*pc = p->instruction_address;
+		return 1;
+	}
+	trace += k - (MAX_STAGES - 1);
+	if(trace->itype != LW && trace->itype != SW)
+		return 0;
+	*type = trace->itype == LW ? ACCESS_LOAD : ACCESS_STORE;
+	*address = trace->data_address;
+	*size = trace->size;
+	*pc = trace->instruction_address;
+	return 1;
+}
+
+/* The memo for a block of n at trace entered with the pipeline as it is, made if new. */
+static block_memo_t *
+block_memo(insn_t *trace, long n)
+{
+	uint h = trace->instruction_address * 0x9e3779b9u + n;
+	long i;
+	int s;
+
+	for(s = 0; s < MAX_STAGES; s++)
+		h = (h ^ pipeline[s].instruction_address ^ pipeline[s].itype << 28) * 0x9e3779b9u;
+	if(2 * (block_memos_used + 1) > block_memos_size){
+		/* a fresh table is as good as a rehashed one: memos only save time */
+		free(block_memos);
+		block_memos_size = block_memos_size ? 2 * block_memos_size : 1024;
+		block_memos = (block_memo_t*) calloc(block_memos_size, sizeof(block_memo_t));
+		block_memos_used = 0;
+	}
+	for(i = h & (block_memos_size-1); block_memos[i].used; i = (i+1) & (block_memos_size-1)){
+		block_memo_t *m = &block_memos[i];
+
+		if(m->pc != trace->instruction_address || m->n != n)
+			continue;
+		for(s = 0; s < MAX_STAGES; s++)
+			if(m->itype[s] != pipeline[s].itype || m->address[s] != pipeline[s].instruction_address)
+				break;
+		if(s == MAX_STAGES)
+			return m;
+	}
+	block_memos[i].used = 1;
+	block_memos[i].pc = trace->instruction_address;
+	block_memos[i].n = n;
+	for(s = 0; s < MAX_STAGES; s++){
+		block_memos[i].itype[s] = pipeline[s].itype;
+		block_memos[i].address[s] = pipeline[s].instruction_address;
+	}
+	block_memos_used++;
+	return &block_memos[i];
+}
+
+/* Whether an access to address would take one cycle, as far as a probe can tell. */
+static int
+block_fast(uint address)
+{
+	region_t *r = nregions ? iplc_sim_region_find(address) : NULL;
+
+	return r ? r->latency == 1 : iplc_sim_cache_probe(&cache, address);
+}
+
+static long
+block_detailed(insn_t *trace, long n)
+{
+	long k;
+
+	for(k = 0; k < n; k++)
+		iplc_sim_issue_instruction(&trace[k]);
+	return n;
+}
+
+/*
+ * Issue the basic block at the start of trace, at most count long, and
+ * return how many instructions that was.  A block is a run of sequential
+ * fetches up to and including the first control transfer, at most
+ * BLOCK_MAX.
+ *
+ * When every fetch and data access the block's pushes make would hit in
+ * one cycle, its timing depends only on the instructions and on what the
+ * pipeline held on entry: hits change no line's residency, so checking
+ * each against the cache, or the region it falls in, beforehand is enough.  The first such entry is
+ * simulated in detail and its cycles, retirements and branch outcomes
+ * remembered; a repeat makes the same accesses, in the same order, and
+ * adds those.  Anything that could miss or straddle blocks is simulated
+ * in detail, as are blocks under page mapping, whose lookups a probe
+ * could not make without mapping pages, and blocks too short to be
+ * worth looking up.
+ */
+long
+iplc_sim_issue_block(insn_t *trace, long count)
+{
+	long n, k;
+	uint last = ~0u, address, pc, entry = trace->instruction_address;
+	int type, size, latency;
+	/* repeat fetches are counted as plain hits, not hits on pinned lines */
+	int direct = !diff_cache.sets && !nlocks;
+	unsigned long long access = 0;
+	long fetches = 0;
+	block_memo_t *m;
+	uint cycles, retired, branches, correct;
+
+	for(n = 0; n < count && n < BLOCK_MAX; ){
+		insn_t *t = &trace[n];
+
+		if(t->nofetch || (n > 0 && t->instruction_address != t[-1].instruction_address + 4))
+			break;
+		n++;
+		if(t->itype == BRANCH || t->itype == JUMP || t->itype == JAL || t->itype == SYSCALL)
+			break;
+	}
+	if(n == 0){
+		iplc_sim_issue_instruction(trace);
+		return 1;
+	}
+	/* short blocks push faster than they are checked */
+	if(n < MAX_STAGES || page_policy != PAGE_NONE)
+		return block_detailed(trace, n);
+	for(k = 0; k < n; k++){
+		uint block = trace[k].instruction_address >> cache.blockoffsetbits;
+
+		if(block != last && !block_fast(trace[k].instruction_address))
+			return block_detailed(trace, n);
+		last = block;
+		if(block_access(trace, k, &type, &address, &size, &pc)){
+			if(iplc_sim_crosses_block(&cache, address, size) || !block_fast(address))
+				return block_detailed(trace, n);
+			access |= 1ull << k;
+		}
+	}
+
+	m = block_memo(trace, n);
+	if(m->cycles == 0){
+		cycles = pipeline_cycles;
+		retired = instruction_count;
+		branches = branch_count;
+		correct = correct_branch_predictions;
+		/* every fetch hits, so each instruction is issued with one push */
+		for(k = 0; k < n; k++){
+			m->at[k] = pipeline_cycles - cycles;
+			iplc_sim_issue_instruction(&trace[k]);
+		}
+		m->cycles = pipeline_cycles - cycles;
+		m->retired = instruction_count - retired;
+		m->branches = branch_count - branches;
+		m->correct = correct_branch_predictions - correct;
+		return n;
+	}
+
+	/* the fetches are entry, entry+4, ...: the block only says where the data goes */
+	last = ~0u;
+	for(k = 0; k < n; k++){
+		uint block = (entry + 4*k) >> cache.blockoffsetbits;
+
+		/* a hit on the block just hit again, with nothing between, changes nothing */
+		if(direct && block == last)
+			fetches++;
+		else
+			iplc_sim_trap_address(entry + 4*k, 4, ACCESS_IFETCH, entry + 4*k, &latency);
+		/* but a fetch from a region never was in the cache */
+		last = nregions && iplc_sim_region_find(entry + 4*k) ? ~0u : block;
+		if(access >> k & 1){
+			block_access(trace, k, &type, &address, &size, &pc);
+			iplc_sim_trap_address(address, size, type, pc, &latency);
+			last = ~0u;
+		}
+	}
+	cache.access += fetches;
+	cache.hit += fetches;
+	/* push k retires the stage k from the end, then the block's own in turn */
+	for(k = 0; k < n && STAT_ON(STATS_LATENCY); k++)
+		if(k < MAX_STAGES ? pipeline[WRITEBACK - k].instruction_address != 0 :
+		   trace[k - MAX_STAGES].itype != NOP)
+			iplc_sim_hist_add(&retire_latency, k < MAX_STAGES ?
+							  pipeline_cycles + m->at[k] - pipeline[WRITEBACK - k].fetched :
+							  m->at[k] - m->at[k - MAX_STAGES]);
+	instruction_count += m->retired;
+	branch_count += m->branches;
+	correct_branch_predictions += m->correct;
+	advance_pipeline(trace, n);
+	for(k = 0; k < MAX_STAGES; k++)
+		pipeline[k].fetched = pipeline_cycles + m->at[n - 1 - k];
+	pipeline_cycles += m->cycles;
+	return n;
+}
+
+/*
+ * Issue what comes next in trace, at most count, as a steady run if the
+ * pipeline has been in one, else as a basic block under -B, else on its
+ * own, and return how many instructions that was.  *simple counts the
+ * loads, stores and branches -free instructions just issued in a row;
+ * start it at 0.
+ */
+long
+iplc_sim_issue_batch(insn_t *trace, long count, long *simple)
+{
+	long n = 0, k;
+	/* fills in flight need each access's own cycle, and lock markers each fetch */
+	int batch = !beat_words && !lock_markers;
+
+	/* the pipeline cannot be steady until five in a row have been issued */
+	if(*simple >= MAX_STAGES && batch)
+		n = iplc_sim_issue_steady(trace, count);
+	if(n == 0 && block_memoize && batch)
+		n = iplc_sim_issue_block(trace, count);
+	if(n == 0){
+		iplc_sim_issue_instruction(trace);
+		n = 1;
+	}
+	for(k = n; k > 0 && steady_itype(trace[k-1].itype); k--)
+		;
+	*simple = k == 0 ? *simple + n : n - k;
+	return n;
+}
+
+/* Trace readers */
+
+/* Up to n bytes of in, from its head first. */
+static size_t
+trace_in_bytes(trace_in_t *in, byte *buf, size_t n)
+{
+	size_t k = 0;
+
+	if(in->pos < in->nhead){
+		k = in->nhead - in->pos < n ? in->nhead - in->pos : n;
+		memcpy(buf, in->head + in->pos, k);
+		in->pos += k;
+	}
+	if(k < n)
+		k += fread(buf + k, 1, n - k, in->f);
+	return k;
+}
+
+/* The next line of in, into in->line; NULL at the end. */
+static byte *
+trace_in_line(trace_in_t *in)
+{
+	size_t i = 0;
+
+	if(in->held){
+		in->held = 0;
+		return in->line;
+	}
+	while(in->pos < in->nhead && i < sizeof(in->line) - 1){
+		in->line[i++] = in->head[in->pos++];
+		if(in->line[i-1] == '\n'){
+			in->line[i] = '\0';
+			return in->line;
+		}
+	}
+	in->line[i] = '\0';
+	if(i < sizeof(in->line) - 1 && fgets((char*) in->line + i, sizeof(in->line) - i, in->f) == NULL && i == 0)
+		return NULL;
+	return in->line;
+}
+
+static unsigned long long
+get64(byte *p)
+{
+	return (unsigned long long) (p[0] | p[1] << 8 | p[2] << 16 | (uint) p[3] << 24) |
+		(unsigned long long) (p[4] | p[5] << 8 | p[6] << 16 | (uint) p[7] << 24) << 32;
+}
+
+/* This simulator's own text: "0x<pc> <instruction> ..." a line. */
+static int
+iplc_detect(byte *head, size_t n)
+{
+	uint pc;
+	char op[16];
+
+	return sscanf((char*) head, "0x%x %15s", &pc, op) == 2 && op[0] >= 'a' && op[0] <= 'z';
+}
+
+static int
+iplc_read(trace_in_t *in, insn_t *insn)
+{
+	byte *line = trace_in_line(in);
+
+	if(line == NULL)
+		return 0;
+	iplc_sim_decode_instruction(line, insn);
+	return 1;
+}
+
+/* Dinero din: "<label> <hex address>" a line; 0 read, 1 write, 2 fetch. */
+static int
+din_detect(byte *head, size_t n)
+{
+	int label;
+	uint address;
+
+	return n > 2 && head[0] >= '0' && head[0] <= '4' && (head[1] == ' ' || head[1] == '\t') &&
+		sscanf((char*) head, "%d %x", &label, &address) == 2;
+}
+
+/*
+ * A fetch and the data reference that follows it are one instruction.
+ * A data reference with no fetch of its own is an access alone, made by
+ * the last instruction fetched.  Escapes (labels 3 and 4) are skipped.
+ */
+static int
+din_read(trace_in_t *in, insn_t *insn)
+{
+	byte *line;
+	int label, fetched = 0;
+	uint address;
+
+	memset(insn, 0, sizeof(insn_t));
+	while((line = trace_in_line(in)) != NULL){
+		if(sscanf((char*) line, "%d %x", &label, &address) != 2 || label < 0 || label > 2)
+			continue;
+		if(label == 2){
+			if(fetched){
+				in->held = 1;
+				return 1;
+			}
+			fetched = 1;
+			in->pc = address;
+			insn->itype = RTYPE;
+			insn->instruction_address = address;
+			continue;
+		}
+		insn->itype = label == 0 ? LW : SW;
+		insn->data_address = address;
+		insn->size = 4;
+		insn->instruction_address = in->pc ? in->pc : RAW_PC;
+		insn->nofetch = !fetched;
+		return 1;
+	}
+	return fetched;
+}
+
+/*
+ * ChampSim input_instr: 64 bytes, little-endian: ip, is_branch,
+ * branch_taken, 2 destination and 4 source registers, 2 destination
+ * and 4 source memory addresses.
+ */
+enum {CHAMPSIM_RECORD = 64};
+
+static int
+champsim_detect(byte *head, size_t n)
+{
+	size_t i;
+
+	if(n < CHAMPSIM_RECORD)
+		return 0;
+	for(i = 0; i + CHAMPSIM_RECORD <= n; i += CHAMPSIM_RECORD){
+		byte *r = head + i;
+
+		if(get64(r) == 0 || r[6] || r[7] || r[8] > 1 || r[9] > 1)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The pipeline does one memory access an instruction: the first source
+ * operand if there is one, else the first destination.  Addresses and
+ * the ip keep their low 32 bits; every access is taken to be a word.
+ */
+static int
+champsim_read(trace_in_t *in, insn_t *insn)
+{
+	byte r[CHAMPSIM_RECORD];
+	int i;
+
+	if(trace_in_bytes(in, r, sizeof(r)) != sizeof(r))
+		return 0;
+	memset(insn, 0, sizeof(insn_t));
+	insn->instruction_address = (uint) get64(r);
+	insn->itype = r[8] ? BRANCH : RTYPE;
+	insn->dest_reg = r[10];
+	insn->reg1 = r[12];
+	insn->reg2_or_constant = r[13];
+	for(i = 0; i < 6; i++){
+		/* sources at 32, destinations at 16 */
+		uint address = (uint) get64(r + (i < 4 ? 32 + 8*i : 16 + 8*(i-4)));
+
+		if(address){
+			insn->itype = i < 4 ? LW : SW;
+			insn->data_address = address;
+			insn->size = 4;
+			break;
+		}
+	}
+	return 1;
+}
+
+/* Raw little-endian addresses, for cache-only runs: each a load alone. */
+static int
+raw_detect(byte *head, size_t n)
+{
+	size_t i;
+
+	/* the last resort: anything that is not text */
+	for(i = 0; i < n; i++)
+		if(head[i] == 0 || head[i] > 126)
+			return 1;
+	return 0;
+}
+
+static int
+raw_read(trace_in_t *in, insn_t *insn, int width)
+{
+	byte a[8];
+
+	if(trace_in_bytes(in, a, width) != width)
+		return 0;
+	if(width == 4)
+		memset(a+4, 0, 4);
+	memset(insn, 0, sizeof(insn_t));
+	insn->itype = LW;
+	insn->instruction_address = RAW_PC;
+	insn->data_address = (uint) get64(a);
+	insn->size = 4;
+	insn->nofetch = 1;
+	return 1;
+}
+
+static int
+raw32_read(trace_in_t *in, insn_t *insn)
+{
+	return raw_read(in, insn, 4);
+}
+
+static int
+raw64_read(trace_in_t *in, insn_t *insn)
+{
+	return raw_read(in, insn, 8);
+}
+
+/* In the order formats are tried; raw64 only when asked for. */
+trace_reader_t trace_readers[] = {
+	{"iplc", iplc_detect, iplc_read},
+	{"din", din_detect, din_read},
+	{"champsim", champsim_detect, champsim_read},
+	{"raw32", raw_detect, raw32_read},
+	{"raw64", NULL, raw64_read},
+};
+
+/* The reader called name; NULL if there is none. */
+trace_reader_t *
+iplc_sim_trace_reader(char *name)
+{
+	int i;
+
+	for(i = 0; i < sizeof(trace_readers)/sizeof(trace_readers[0]); i++)
+		if(strcmp(name, trace_readers[i].name) == 0)
+			return &trace_readers[i];
+	return NULL;
+}
+
+/*
+ * Open the trace at path, read through gzip or xz if its name says it is
+ * compressed, and find its reader: trace_format if -T gave one, else the
+ * first that recognises its head.
+ */
+trace_in_t *
+iplc_sim_trace_open(char *path)
+{
+	trace_in_t *in = (trace_in_t*) calloc(1, sizeof(trace_in_t));
+	size_t len = strlen(path);
+	char *unpack = NULL;
+	int i;
+
+	if(len > 3 && strcmp(path + len - 3, ".gz") == 0)
+		unpack = "gzip";
+	if(len > 3 && strcmp(path + len - 3, ".xz") == 0)
+		unpack = "xz";
+	if(unpack && strchr(path, '\'') == NULL){
+		char command[1100];
+
+		snprintf(command, sizeof(command), "%s -dc '%s' 2>/dev/null", unpack, path);
+		in->f = popen(command, "r");
+		in->pipe = 1;
+	}else
+		in->f = fopen(path, "r");
+	if(in->f == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+
+	in->nhead = fread(in->head, 1, sizeof(in->head) - 1, in->f);
+	in->reader = trace_format;
+	for(i = 0; in->reader == NULL && i < sizeof(trace_readers)/sizeof(trace_readers[0]); i++)
+		if(trace_readers[i].detect && trace_readers[i].detect(in->head, in->nhead))
+			in->reader = &trace_readers[i];
+	if(in->reader == NULL){
+		if(in->nhead == 0)
+			in->reader = &trace_readers[0];
+		else{
+			printf("Cannot tell the format of %s; give -T \n", path);
+			exit(-1);
+		}
+	}
+	return in;
+}
+
+/* The next record of in, decoded; 0 at the end of the trace. */
+int
+iplc_sim_trace_read(trace_in_t *in, insn_t *insn)
+{
+	return in->reader->read(in, insn);
+}
+
+void
+iplc_sim_trace_close(trace_in_t *in)
+{
+	if(in->pipe)
+		pclose(in->f);
+	else
+		fclose(in->f);
+	free(in);
+}
+
+/* Whole-trace functions */
+
+/*
+ * Decode an entire trace into memory, so that it can be simulated many
+ * times without parsing it again.
+ */
+insn_t *
+iplc_sim_load_trace(trace_in_t *in, long *count)
+{
+	insn_t *trace = NULL;
+	long n = 0, cap = 0;
+
+	for(;;){
+		if(n == cap){
+			cap = cap ? 2*cap : 4096;
+			trace = (insn_t*) realloc(trace, sizeof(insn_t) * cap);
+			if(trace == NULL){
+				printf("Out of memory loading trace \n");
+				exit(-1);
+			}
+		}
+		if(!iplc_sim_trace_read(in, &trace[n]))
+			break;
+		n++;
+	}
+	*count = n;
+	return trace;
+}
+
+/*
+ * Simulate a decoded trace on the configuration set up by iplc_sim_init,
+ * leaving the pipeline drained and the counters ready to read.
+ */
+void
+iplc_sim_run(insn_t *trace, long count)
+{
+	long i, n, simple = 0;
+
+	for(i = 0; i < count; i += n){
+		if(verbose){
+			iplc_sim_issue_instruction(&trace[i]);
+			if (dump_pipeline)
+				iplc_sim_dump_pipeline();
+			n = 1;
+			continue;
+		}
+		/* nothing to show for each instruction, so take runs and blocks whole */
+		n = iplc_sim_issue_batch(&trace[i], count - i, &simple);
+		stats_tick(n);
+	}
+	iplc_sim_drain();
+}
+
+/* Outcome streams */
+
+/*
+ * An outcome stream is an 8 byte magic, then as 32-bit little-endian
+ * words the cache's sets, blocksize and assoc, the prediction, the
+ * branch penalty, the miss delay, the number of levels below the cache
+ * and each one's latency, then as 64-bit words the instructions retired,
+ * the pipeline pushes and the events that follow.  An event is a byte:
+ * bit 7 set for a fetch that stalled, with what served it in bits 2-4;
+ * clear for a push with a branch in DECODE or an access in MEM, with
+ * bits 0-1 none, not taken or taken, bits 2-4 what served the access, or
+ * OUTCOME_NONE, and bit 5 set if it straddled blocks, when a byte with
+ * what served the second block follows.  An OUTCOME_FIXED access is
+ * followed by its latency, 32 bits.
+ *
+ * What hits where does not depend on the prediction, nor on the
+ * latencies but through the shape of fetch stalls, and whether the
+ * model calls a branch taken depends only on what is fetched behind it,
+ * so the stream times the run again under any of those.
+ */
+static byte outcome_magic[8] = "IPLCOC02";
+
+enum {
+	OUTCOME_HEADER = 8 + 4 * (7 + MAX_LEVELS - 1) + 8 * 3,
+	OUTCOME_FETCH = 0x80,
+	OUTCOME_STRADDLE = 0x20
+};
+
+static void
+outcome_header(byte *hdr)
+{
+	int level;
+
+	memset(hdr, 0, OUTCOME_HEADER);
+	memcpy(hdr, outcome_magic, 8);
+	put32(hdr+8, cache.nsets);
+	put32(hdr+12, cache.blocksize);
+	put32(hdr+16, cache.assoc);
+	put32(hdr+20, branch_predict_taken);
+	put32(hdr+24, BRANCH_PENALTY);
+	put32(hdr+28, memory_latency);
+	put32(hdr+32, nlower);
+	for(level = 0; level < nlower; level++)
+		put32(hdr+36 + 4*level, lower_config[level].latency);
+	put32(hdr+48, instruction_count);
+	put32(hdr+56, outcome_pushes);
+	put32(hdr+60, outcome_pushes >> 32);
+	put32(hdr+64, outcome_events);
+	put32(hdr+68, outcome_events >> 32);
+}
+
+/*
+ * Record the cache and branch outcomes of this run in path.  Must follow
+ * iplc_sim_init; the header is filled in by iplc_sim_outcomes_close.
+ */
+void
+iplc_sim_outcomes_open(char *path)
+{
+	byte hdr[OUTCOME_HEADER];
+
+	if((outcomes = fopen(path, "wb")) == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	outcome_pushes = outcome_events = 0;
+	outcome_header(hdr);
+	fwrite(hdr, 1, sizeof(hdr), outcomes);
+}
+
+/* What served the access just trapped, as its event bytes. */
+static void
+outcome_access(byte *ev, int n)
+{
+	if(trap_code[0] == OUTCOME_FIXED){
+		put32(ev + n, trap_fixed);
+		n += 4;
+	}else if(trap_code[1] != OUTCOME_NONE){
+		ev[0] |= OUTCOME_STRADDLE;
+		ev[n++] = trap_code[1];
+	}
+	fwrite(ev, 1, n, outcomes);
+	outcome_events++;
+}
+
+/*
+ * A push has just been made; branch is 1 + whether the branch in DECODE
+ * was taken, if there was one, and data whether MEM made an access.
+ */
+void
+iplc_sim_outcome_push(int branch, int data)
+{
+	byte ev[6];
+
+	outcome_pushes++;
+	if(!branch && !data)
+		return;
+	ev[0] = branch | (data ? trap_code[0] : OUTCOME_NONE) << 2;
+	if(!data){
+		fwrite(ev, 1, 1, outcomes);
+		outcome_events++;
+		return;
+	}
+	outcome_access(ev, 1);
+}
+
+/* The fetch just trapped stalls the pipeline. */
+void
+iplc_sim_outcome_fetch()
+{
+	byte ev[6];
+
+	ev[0] = OUTCOME_FETCH | trap_code[0] << 2;
+	outcome_access(ev, 1);
+}
+
+void
+iplc_sim_outcomes_close()
+{
+	byte hdr[OUTCOME_HEADER];
+
+	outcome_header(hdr);
+	if(fseek(outcomes, 0, SEEK_SET) < 0){
+		perror("fseek");
+		exit(-1);
+	}
+	fwrite(hdr, 1, sizeof(hdr), outcomes);
+	fclose(outcomes);
+	outcomes = NULL;
+}
+
+/* One timing to replay a stream under, and what it came to */
+typedef struct outcome_variant{
+	int predict;
+	int penalty;
+	int memory_latency;
+	int latency[MAX_LEVELS-1];
+	long cycles;
+	long correct;
+	int inexact;        /* a fetch stall drained the pipeline differently */
+} outcome_variant_t;
+
+static int
+outcome_latency(outcome_variant_t *v, int code, int fixed)
+{
+	if(code == 0)
+		return 1;
+	if(code < OUTCOME_MEMORY)
+		return v->latency[code-1];
+	if(code == OUTCOME_MEMORY)
+		return v->memory_latency;
+	return fixed;
+}
+
+/*
+ * Parse a variant, name=value pairs separated by commas, of predict,
+ * penalty, missdelay and l2, l3 ..., over v; -1 if it is not that.
+ */
+static int
+outcome_parse_variant(char *s, outcome_variant_t *v, int nlevels)
+{
+	char name[16];
+	int value, n, level;
+
+	while(sscanf(s, "%15[^=]=%d%n", name, &value, &n) == 2){
+		if(strcmp(name, "predict") == 0 && (value == 0 || value == 1))
+			v->predict = value;
+		else if(strcmp(name, "penalty") == 0 && value >= 0)
+			v->penalty = value;
+		else if(strcmp(name, "missdelay") == 0 && value > 0)
+			v->memory_latency = value;
+		else if(sscanf(name, "l%d", &level) == 1 && level >= 2 && level < 2 + nlevels && value > 0)
+			v->latency[level-2] = value;
+		else
+			return -1;
+		s += n;
+		if(*s == ',')
+			s++;
+	}
+	return *s ? -1 : 0;
+}
+
+/*
+ * Time the run recorded in path again under each variant, or, with
+ * none, under the recorded latencies with either prediction, from its
+ * outcomes alone.  Every push costs a cycle, or more for a mispredicted
+ * branch or a slow access, and a fetch stall as many pushes as its
+ * latency less one.  A stall pushes the older instructions through in
+ * MAX_STAGES - 1 pushes, and any after that are empty; a variant whose
+ * stalls change how many of those they take may order the cache's
+ * accesses differently, and is marked.
+ */
+void
+iplc_sim_outcomes_replay(char *path, char **variants, int nvariants)
+{
+	FILE *f = fopen(path, "rb");
+	byte hdr[OUTCOME_HEADER], ev[5];
+	outcome_variant_t rec, *v;
+	long instructions, pushes, events, k;
+	int nv = nvariants ? nvariants : 2, nlevels, i, level, inexact = 0;
+
+	if(f == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	if(fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, outcome_magic, 8) != 0){
+		printf("%s is not an outcome stream \n", path);
+		exit(-1);
+	}
+	memset(&rec, 0, sizeof(rec));
+	rec.predict = get32(hdr+20);
+	rec.penalty = get32(hdr+24);
+	rec.memory_latency = get32(hdr+28);
+	nlevels = get32(hdr+32);
+	for(level = 0; level < nlevels && level < MAX_LEVELS-1; level++)
+		rec.latency[level] = get32(hdr+36 + 4*level);
+	instructions = get32(hdr+48);
+	pushes = get64(hdr+56);
+	events = get64(hdr+64);
+
+	v = (outcome_variant_t*) malloc(sizeof(outcome_variant_t) * nv);
+	for(i = 0; i < nv; i++){
+		v[i] = rec;
+		if(nvariants == 0)
+			v[i].predict = i;
+		else if(outcome_parse_variant(variants[i], &v[i], nlevels) < 0){
+			printf("%s is not a variant of %s \n", variants[i], path);
+			exit(-1);
+		}
+		v[i].cycles = pushes;
+	}
+
+	for(k = 0; k < events && fread(ev, 1, 1, f) == 1; k++){
+		int code = ev[0] >> 2 & 7, second = OUTCOME_NONE, fixed = 0;
+
+		if(code == OUTCOME_FIXED){
+			if(fread(ev+1, 1, 4, f) != 4)
+				break;
+			fixed = get32(ev+1);
+		}else if(ev[0] & OUTCOME_STRADDLE && !(ev[0] & OUTCOME_FETCH)){
+			if(fread(ev+1, 1, 1, f) != 1)
+				break;
+			second = ev[1];
+		}
+		for(i = 0; i < nv; i++){
+			if(ev[0] & OUTCOME_FETCH){
+				int was = outcome_latency(&rec, code, fixed) - 1, is = outcome_latency(&v[i], code, fixed) - 1;
+
+				v[i].cycles += is - was;
+				if((was < MAX_STAGES-1 ? was : MAX_STAGES-1) != (is < MAX_STAGES-1 ? is : MAX_STAGES-1))
+					v[i].inexact = 1;
+			}else{
+				int branch = ev[0] & 3, cycles = 1, mem = 1;
+
+				if(branch && branch - 1 == v[i].predict)
+					v[i].correct++;
+				else if(branch)
+					cycles = 1 + v[i].penalty;
+				if(code != OUTCOME_NONE)
+					mem = outcome_latency(&v[i], code, fixed);
+				if(second != OUTCOME_NONE){
+					int other = outcome_latency(&v[i], second, 0);
+
+					mem = (other > mem ? other : mem) + 1;
+				}
+				v[i].cycles += (mem > cycles ? mem : cycles) - 1;
+			}
+		}
+	}
+	fclose(f);
+	if(k < events){
+		printf("%s is cut short \n", path);
+		exit(-1);
+	}
+
+	printf("Outcome Replay \n");
+	printf("\t Recorded under Sets %u, BlockSize %u, Assoc %u, Predict %u, Penalty %u, MissDelay %u \n",
+		   get32(hdr+8), get32(hdr+12), get32(hdr+16), rec.predict, rec.penalty, rec.memory_latency);
+	printf("\t Instructions is %ld, Pushes is %ld, Events is %ld \n\n", instructions, pushes, events);
+	printf("\t Predict\t Penalty\t MissDelay\t Lower\t\t Cycles\t\t CPI\t\t Correct \n");
+	for(i = 0; i < nv; i++){
+		char lower[64] = "-";
+		int len = 0;
+
+		for(level = 0; level < nlevels && len < sizeof(lower); level++)
+			len += snprintf(lower + len, sizeof(lower) - len, "%s%d", level ? "," : "", v[i].latency[level]);
+		printf("\t %d\t\t %d\t\t %d\t\t %s\t\t %ld\t\t %f\t %ld%s \n", v[i].predict, v[i].penalty,
+			   v[i].memory_latency, lower, v[i].cycles,
+			   instructions ? (double)v[i].cycles / (double)instructions : 0, v[i].correct,
+			   v[i].inexact ? " *" : "");
+		inexact |= v[i].inexact;
+	}
+	if(inexact)
+		printf("\t * fetch stalls of another length may reorder cache accesses; simulate it to be exact \n");
+	printf("\n");
+	free(v);
+}
+
+/* Result cache */
+
+/*
+ * FNV-1a over the decoded records, so the same instructions hash the
+ * same however the trace file was laid out.
+ */
+unsigned long long
+iplc_sim_trace_hash(insn_t *trace, long count)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	byte *p = (byte*) trace, *end = (byte*) (trace + count);
+
+	for(; p < end; p++){
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*
+ * The canonical name of one simulation: simulator version, trace, and
+ * every setting that can change its statistics.  window is the sweep
+ * window the per-window samples were taken at, or 0.  A key that does
+ * not fit in n bytes would name other configurations too, so is fatal.
+ */
+void
+iplc_sim_result_key(char *key, int n, unsigned long long hash, long count,
+					int index, int blocksize, int assoc, long window)
+{
+	int len, level;
+
+	len = snprintf(key, n, "v%d trace=%016llx n=%ld index=%d blocksize=%d assoc=%d "
+				   "policy=%s predict=%u missdelay=%d window=%ld",
+				   SIM_VERSION, hash, count, index, blocksize, assoc,
+				   cache_policy == REPLACE_LRU ? "lru" : "fifo", branch_predict_taken,
+				   memory_latency, window);
+	if(page_policy != PAGE_NONE && len < n)
+		len += snprintf(key + len, n - len, " pages=%s,%u,%s", page_policy_names[page_policy],
+						page_size, page_virtual_l1 ? "virt" : "phys");
+	if(beat_words && len < n)
+		len += snprintf(key + len, n - len, " fill=%d,%d,%s", beat_words, beat_cycles,
+						fill_order_names[fill_order]);
+	for(level = 0; level < nlocks && len < n; level++)
+		len += snprintf(key + len, n - len, " lock=%#x,%#x,%#x,%#x", locks[level].base,
+						locks[level].size, locks[level].lock_pc, locks[level].unlock_pc);
+	for(level = 0; level < nregions && len < n; level++)
+		len += snprintf(key + len, n - len, " region=%#x,%#x,%d,%s", region[level].base,
+						region[level].size, region[level].latency,
+						region_kind_names[region[level].kind]);
+	if(l1_sets && len < n)
+		len += snprintf(key + len, n - len, " sets=%d", l1_sets);
+	for(level = 0; level < nlower && len < n; level++)
+		len += snprintf(key + len, n - len, " l%d=%d%s,%d,%d,%d", level+2,
+						lower_config[level].sets == 1 << lower_config[level].index ?
+						lower_config[level].index : lower_config[level].sets,
+						lower_config[level].sets == 1 << lower_config[level].index ? "" : "s",
+						lower_config[level].blocksize, lower_config[level].assoc,
+						lower_config[level].latency);
+	if(len >= n){
+		printf("Result cache key is longer than %d bytes \n", n);
+		exit(-1);
+	}
+}
+
+/* Statistics of the simulation just run: those the registry keeps in a result. */
+void
+iplc_sim_result_collect(sim_result_t *r)
+{
+	int i;
+
+	for(i = 0; i < sizeof(stat_registry) / sizeof(statistic_t); i++){
+		statistic_t *st = &stat_registry[i];
+
+		if(st->kind == STAT_SCALAR && (st->flags & STAT_RESULT))
+			*(long*)((byte*) r + st->result) = iplc_sim_stat_value(st, 0);
+	}
+}
+
+static result_entry_t *
+results_add(char *key)
+{
+	if(nresults == results_cap){
+		results_cap = results_cap ? 2*results_cap : 256;
+		results = (result_entry_t*) realloc(results, sizeof(result_entry_t) * results_cap);
+	}
+	memset(&results[nresults], 0, sizeof(result_entry_t));
+	results[nresults].key = strdup(key);
+	return &results[nresults++];
+}
+
+/*
+ * Load the result cache at path, creating it if need be; results
+ * stored from now on are appended to it.  One line per result:
+ *	key TAB cycles instructions branches correct access miss hit
+ *	[TAB nwin, then cycles instructions branches correct access miss per window]
+ */
+void
+iplc_sim_results_open(char *path)
+{
+	char *line = NULL, *tab, *val;
+	size_t cap = 0;
+	result_entry_t *e;
+	long w;
+
+	if((results_file = fopen(path, "a+")) == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	rewind(results_file);
+	while(getline(&line, &cap, results_file) > 0){
+		if((tab = strchr(line, '\t')) == NULL)
+			continue;
+		*tab = '\0';
+		e = results_add(line);
+		val = tab + 1;
+		e->r.cycles = strtol(val, &val, 10);
+		e->r.instructions = strtol(val, &val, 10);
+		e->r.branches = strtol(val, &val, 10);
+		e->r.correct_branches = strtol(val, &val, 10);
+		e->r.access = strtol(val, &val, 10);
+		e->r.miss = strtol(val, &val, 10);
+		e->r.hit = strtol(val, &val, 10);
+		if((e->nwin = strtol(val, &val, 10)) <= 0)
+			continue;
+		e->win = (sweep_sample_t*) calloc(e->nwin, sizeof(sweep_sample_t));
+		for(w = 0; w < e->nwin; w++){
+			e->win[w].cycles = strtol(val, &val, 10);
+			e->win[w].instructions = strtol(val, &val, 10);
+			e->win[w].branches = strtol(val, &val, 10);
+			e->win[w].correct_branches = strtol(val, &val, 10);
+			e->win[w].access = strtol(val, &val, 10);
+			e->win[w].miss = strtol(val, &val, 10);
+		}
+		e->win[e->nwin-1].done = 1;
+	}
+	free(line);
+}
+
+result_entry_t *
+iplc_sim_results_find(char *key)
+{
+	long i;
+
+	for(i = nresults-1; i >= 0; i--)
+		if(strcmp(results[i].key, key) == 0)
+			return &results[i];
+	return NULL;
+}
+
+/*
+ * Remember a completed simulation, in memory and on disk.  Each result is
+ * one write to a file opened for appending, so concurrent sweeps sharing
+ * a cache do not interleave lines.
+ */
+void
+iplc_sim_results_store(char *key, sim_result_t *r, sweep_sample_t *win, long nwin)
+{
+	result_entry_t *e = results_add(key);
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&buf, &len);
+	long w;
+
+	e->r = *r;
+	fprintf(f, "%s\t%ld %ld %ld %ld %ld %ld %ld", key, r->cycles, r->instructions,
+			r->branches, r->correct_branches, r->access, r->miss, r->hit);
+	if(nwin > 0){
+		e->nwin = nwin;
+		e->win = (sweep_sample_t*) malloc(sizeof(sweep_sample_t) * nwin);
+		memcpy(e->win, win, sizeof(sweep_sample_t) * nwin);
+		fprintf(f, "\t%ld", nwin);
+		for(w = 0; w < nwin; w++)
+			fprintf(f, " %ld %ld %ld %ld %ld %ld", win[w].cycles, win[w].instructions,
+					win[w].branches, win[w].correct_branches, win[w].access, win[w].miss);
+	}
+	fprintf(f, "\n");
+	fclose(f);
+	fflush(results_file);
+	if(write(fileno(results_file), buf, len) != (ssize_t)len)
+		printf("Warning: result cache write failed \n");
+	free(buf);
+}
+
+/* Design space search */
+
+/*
+ * Parse "lo-hi" or a single value into r.
+ */
+int
+iplc_sim_parse_range(char *s, range_t *r)
+{
+	char *dash;
+
+	r->lo = r->hi = atoi(s);
+	if((dash = strchr(s, '-')) != NULL)
+		r->hi = atoi(dash+1);
+	return r->lo > 0 && r->lo <= r->hi;
+}
+
+/* Move tag to the top of one set's LRU stack, counting the depth it was found at. */
+static void
+stack_touch(uint *stack, int *fill, int depth, uint tag, long *hist)
+{
+	int d;
+
+	for(d = 0; d < *fill; d++)
+		if(stack[d] == tag)
+			break;
+	if(d < *fill)
+		hist[d]++;
+	else if(*fill < depth)
+		(*fill)++;
+	else
+		d = depth-1;
+	memmove(&stack[1], &stack[0], sizeof(uint) * d);
+	stack[0] = tag;
+}
+
+/*
+ * One LRU stack-distance pass over the trace for an (index, blocksize) pair.
+ * LRU is a stack algorithm, so this single pass gives the exact instruction
+ * and data miss counts of every associativity 1..depth at once:
+ * imiss[a] and dmiss[a] for a ways.
+ */
+void
+iplc_sim_stack_distance(insn_t *trace, long count, int index, int blocksize,
+						int depth, long *imiss, long *dmiss)
+{
+	int sets = 1 << index;
+	int offsetbits = (int) rint((log( (double) (blocksize * 4) )/ log(2)));
+	uint *stack = (uint*) malloc(sizeof(uint) * sets * depth);
+	int *fill = (int*) calloc(sets, sizeof(int));
+	long *ihist = (long*) calloc(depth, sizeof(long));
+	long *dhist = (long*) calloc(depth, sizeof(long));
+	long iaccess = 0, daccess = 0;
+	long i;
+	int a;
+
+	for(i = 0; i < count; i++){
+		uint addr = trace[i].instruction_address >> offsetbits;
+		uint set = addr & (sets-1);
+
+		if(!trace[i].nofetch){
+			stack_touch(&stack[set*depth], &fill[set], depth, addr >> index, ihist);
+			iaccess++;
+		}
+		if(trace[i].itype == LW || trace[i].itype == SW){
+			addr = trace[i].data_address >> offsetbits;
+			set = addr & (sets-1);
+			stack_touch(&stack[set*depth], &fill[set], depth, addr >> index, dhist);
+			daccess++;
+		}
+	}
+
+	imiss[0] = iaccess;
+	dmiss[0] = daccess;
+	for(a = 1; a <= depth; a++){
+		imiss[a] = imiss[a-1] - ihist[a-1];
+		dmiss[a] = dmiss[a-1] - dhist[a-1];
+	}
+	free(stack);
+	free(fill);
+	free(ihist);
+	free(dhist);
+}
+
+static int
+tune_point_cmp(const void *a, const void *b)
+{
+	const tune_point_t *p = a, *q = b;
+
+	if(p->size != q->size)
+		return p->size < q->size ? -1 : 1;
+	return p->est_cpi < q->est_cpi ? -1 : p->est_cpi > q->est_cpi;
+}
+
+/*
+ * Search the configurations within the tune_* ranges whose cache fits in
+ * budget bits.  Every feasible point gets a CPI estimate from a
+ * stack-distance pass; only points within tune_slack of the estimated
+ * CPI-vs-size frontier are fully simulated.  Prints the measured frontier.
+ * The stacks are LRU and every miss is charged the latency of the level
+ * below, so main refuses -t with FIFO, regions, locks and fills in beats.
+ */
+void
+iplc_sim_tune(insn_t *trace, long count, unsigned long budget)
+{
+	tune_point_t *pts = NULL;
+	int npts = 0, cap = 0, nsim = 0, ncached = 0;
+	unsigned long long hash = 0;
+	char key[RESULT_KEY];
+	int index, blocksize, assoc, i, j;
+	long retired = 0, mispredicts = 0, k;
+	long *imiss, *dmiss;
+	double best;
+	int miss_delay = nlower ? lower_config[0].latency : memory_latency;
+
+	/* Branch outcomes do not depend on the cache; count them once. */
+	for(k = 0; k < count; k++){
+		if(trace[k].itype != NOP)
+			retired++;
+		if(trace[k].itype == BRANCH && k+1 < count){
+			int taken = trace[k+1].instruction_address != trace[k].instruction_address + 4;
+			if(taken != branch_predict_taken)
+				mispredicts++;
+		}
+	}
+	if(retired == 0){
+		printf("Empty trace \n");
+		exit(-1);
+	}
+
+	imiss = (long*) malloc(sizeof(long) * (tune_assoc.hi + 1));
+	dmiss = (long*) malloc(sizeof(long) * (tune_assoc.hi + 1));
+
+	for(index = tune_index.lo; index <= tune_index.hi; index++){
+		for(blocksize = 1; blocksize <= tune_blocksize.hi; blocksize <<= 1){
+			int depth = 0;
+
+			if(blocksize < tune_blocksize.lo)
+				continue;
+			for(assoc = 1; assoc <= tune_assoc.hi; assoc <<= 1)
+				if(assoc >= tune_assoc.lo && iplc_sim_cache_size(1 << index, blocksize, assoc) <= budget)
+					depth = assoc;
+			if(depth == 0)
+				continue;
+
+			iplc_sim_stack_distance(trace, count, index, blocksize, depth, imiss, dmiss);
+			for(assoc = 1; assoc <= depth; assoc <<= 1){
+				if(assoc < tune_assoc.lo)
+					continue;
+				if(npts == cap){
+					cap = cap ? 2*cap : 64;
+					pts = (tune_point_t*) realloc(pts, sizeof(tune_point_t) * cap);
+				}
+				memset(&pts[npts], 0, sizeof(tune_point_t));
+				pts[npts].index = index;
+				pts[npts].blocksize = blocksize;
+				pts[npts].assoc = assoc;
+				pts[npts].size = iplc_sim_cache_size(1 << index, blocksize, assoc);
+				/* one cycle per instruction, plus the drain, mispredicts and miss stalls */
+				pts[npts].est_cpi = (double)(retired + MAX_STAGES - 1 + mispredicts +
+					(long)(miss_delay - 1) * (imiss[assoc] + dmiss[assoc])) / retired;
+				npts++;
+			}
+		}
+	}
+	free(imiss);
+	free(dmiss);
+
+	if(npts == 0){
+		printf("No configuration fits in %lu bits \n", budget);
+		exit(-1);
+	}
+	qsort(pts, npts, sizeof(tune_point_t), tune_point_cmp);
+
+	/* Fully simulate what survives the estimate; the rest is dominated. */
+	max_cache_size = budget;
+	verbose = 0;
+	if(results_file)
+		hash = iplc_sim_trace_hash(trace, count);
+	best = pts[0].est_cpi;
+	for(i = 0; i < npts; i++){
+		sim_result_t res;
+		result_entry_t *e = NULL;
+
+		if(pts[i].est_cpi < best)
+			best = pts[i].est_cpi;
+		if(pts[i].est_cpi > best * (1 + tune_slack))
+			continue;
+
+		if(results_file){
+			iplc_sim_result_key(key, sizeof(key), hash, count, pts[i].index,
+								pts[i].blocksize, pts[i].assoc, 0);
+			e = iplc_sim_results_find(key);
+		}
+		if(e){
+			res = e->r;
+			ncached++;
+		}else{
+			iplc_sim_init(pts[i].index, pts[i].blocksize, pts[i].assoc);
+			iplc_sim_run(trace, count);
+			iplc_sim_result_collect(&res);
+			if(results_file)
+				iplc_sim_results_store(key, &res, NULL, 0);
+		}
+		pts[i].cpi = iplc_sim_stat_of("core.cpi", &res);
+		pts[i].miss_rate = iplc_sim_stat_of("l1.miss_rate", &res);
+		pts[i].simulated = 1;
+		nsim++;
+	}
+	iplc_sim_free();
+
+	printf("Design Space Search \n");
+	printf("\t Budget is %lu bits \n", budget);
+	printf("\t Feasible Configurations is %d \n", npts);
+	printf("\t Fully Simulated is %d (%d from Result Cache) \n\n", nsim, ncached);
+	printf("Pareto Frontier (CPI vs. CacheSize) \n");
+	printf("\t Index\t BlockSize\t Assoc\t CacheSize\t CPI\t\t MissRate \n");
+	best = 0;
+	for(i = 0; i < npts; i++){
+		if(!pts[i].simulated)
+			continue;
+		/* skip points beaten by a smaller or equal sized one */
+		for(j = 0; j < npts; j++)
+			if(j != i && pts[j].simulated && pts[j].size <= pts[i].size &&
+			   (pts[j].cpi < pts[i].cpi || (pts[j].cpi == pts[i].cpi && j < i)))
+				break;
+		if(j < npts)
+			continue;
+		printf("\t %d\t %d\t\t %d\t %lu\t\t %f\t %f \n", pts[i].index, pts[i].blocksize,
+			   pts[i].assoc, pts[i].size, pts[i].cpi, pts[i].miss_rate);
+	}
+	printf("\n");
+	free(pts);
+}
+
+/* What-if sensitivity */
+
+/*
+ * Simulate trace in a configuration with the geometry given and the
+ * rest as the globals have it, or take it from the result cache; 0 if
+ * the cache would be too big to simulate.
+ */
+static int
+whatif_run(insn_t *trace, long count, unsigned long long hash, int index, int blocksize,
+		   int assoc, sim_result_t *r)
+{
+	char key[RESULT_KEY];
+	result_entry_t *e = NULL;
+
+	if(iplc_sim_cache_size(l1_sets ? l1_sets : 1 << index, blocksize, assoc) > max_cache_size)
+		return 0;
+	if(results_file){
+		iplc_sim_result_key(key, sizeof(key), hash, count, index, blocksize, assoc, 0);
+		e = iplc_sim_results_find(key);
+	}
+	if(e){
+		*r = e->r;
+		return 1;
+	}
+	iplc_sim_init(index, blocksize, assoc);
+	iplc_sim_run(trace, count);
+	iplc_sim_result_collect(r);
+	if(results_file)
+		iplc_sim_results_store(key, r, NULL, 0);
+	return 1;
+}
+
+/* Units w's value v is from base b. */
+static double
+whatif_units(whatif_t *w, int v, int b)
+{
+	if(w->kind == WHATIF_DOUBLE)
+		return log((double) v / b) / log(2);
+	return v - b;
+}
+
+static int
+whatif_cmp(const void *a, const void *b)
+{
+	const whatif_t *p = a, *q = b;
+
+	return fabs(p->cpi) < fabs(q->cpi) ? 1 : fabs(p->cpi) > fabs(q->cpi) ? -1 : 0;
+}
+
+/*
+ * Move each parameter of the configuration given, one at a time, a unit
+ * either side of where it is, simulate trace in each, and print how much
+ * CPI and the miss rate change per unit, biggest CPI change first: a
+ * step of a cycle for latencies, a bit for the index, a doubling for the
+ * other geometry, and a switch to the other prediction.  The change is
+ * the slope between the two sides, or between the base and the one side
+ * that could be simulated.
+ */
+void
+iplc_sim_whatif(insn_t *trace, long count, int index, int blocksize, int assoc)
+{
+	whatif_t w[8 + MAX_LEVELS];
+	sim_result_t base, r[2];
+	unsigned long long hash = 0;
+	double base_cpi, base_miss;
+	int n = 0, i, side, b, level;
+	int predict = branch_predict_taken;
+
+	verbose = 0;
+	if(results_file)
+		hash = iplc_sim_trace_hash(trace, count);
+	if(!whatif_run(trace, count, hash, index, blocksize, assoc, &base)){
+		printf("Cache too big. Great than MAX SIZE of %lu .... \n", max_cache_size);
+		exit(-1);
+	}
+	base_cpi = iplc_sim_stat_of("core.cpi", &base);
+	base_miss = iplc_sim_stat_of("l1.miss_rate", &base);
+
+	memset(w, 0, sizeof(w));
+	if(l1_sets){
+		strcpy(w[n].name, "sets");
+		w[n].unit = "doubling";
+		w[n].value = &l1_sets;
+		w[n].kind = WHATIF_DOUBLE;
+		w[n++].min = 1;
+	}else{
+		strcpy(w[n].name, "index");
+		w[n].unit = "bit";
+		w[n].value = &index;
+		w[n].kind = WHATIF_STEP;
+		w[n++].min = 0;
+	}
+	strcpy(w[n].name, "blocksize");
+	w[n].unit = "doubling";
+	w[n].value = &blocksize;
+	w[n].kind = WHATIF_DOUBLE;
+	w[n++].min = 1;
+	strcpy(w[n].name, "assoc");
+	w[n].unit = "doubling";
+	w[n].value = &assoc;
+	w[n].kind = WHATIF_DOUBLE;
+	w[n++].min = 1;
+	strcpy(w[n].name, "missdelay");
+	w[n].unit = "cycle";
+	w[n].value = &memory_latency;
+	w[n].kind = WHATIF_STEP;
+	w[n++].min = 1;
+	for(level = 0; level < nlower; level++){
+		snprintf(w[n].name, sizeof(w[n].name), "l%d latency", level+2);
+		w[n].unit = "cycle";
+		w[n].value = &lower_config[level].latency;
+		w[n].kind = WHATIF_STEP;
+		w[n++].min = 1;
+	}
+	if(beat_words){
+		strcpy(w[n].name, "beatcycles");
+		w[n].unit = "cycle";
+		w[n].value = &beat_cycles;
+		w[n].kind = WHATIF_STEP;
+		w[n++].min = 1;
+	}
+	strcpy(w[n].name, "predict");
+	w[n].unit = "switch";
+	w[n].value = &predict;
+	w[n].kind = WHATIF_FLIP;
+	w[n++].min = 0;
+
+	for(i = 0; i < n; i++){
+		double lo = 0, hi = 0, cpi[2] = {base_cpi, base_cpi}, miss[2] = {base_miss, base_miss};
+
+		b = *w[i].value;
+		for(side = 0; side < 2; side++){
+			switch(w[i].kind){
+			case WHATIF_STEP:
+				w[i].tried[side] = side ? b + 1 : b - 1;
+				break;
+			case WHATIF_DOUBLE:
+				w[i].tried[side] = side ? 2 * b : b / 2;
+				break;
+			default:
+				if(!side)
+					continue;
+				w[i].tried[side] = !b;
+			}
+			if(w[i].tried[side] < w[i].min || w[i].tried[side] == b)
+				continue;
+			*w[i].value = w[i].tried[side];
+			branch_predict_taken = predict;
+			w[i].have[side] = whatif_run(trace, count, hash, index, blocksize, assoc, &r[side]);
+			*w[i].value = b;
+			branch_predict_taken = predict;
+			if(!w[i].have[side])
+				continue;
+			cpi[side] = iplc_sim_stat_of("core.cpi", &r[side]);
+			miss[side] = iplc_sim_stat_of("l1.miss_rate", &r[side]);
+			if(side)
+				hi = w[i].kind == WHATIF_FLIP ? 1 : whatif_units(&w[i], w[i].tried[side], b);
+			else
+				lo = whatif_units(&w[i], w[i].tried[side], b);
+		}
+		if(hi != lo){
+			w[i].cpi = (cpi[1] - cpi[0]) / (hi - lo);
+			w[i].miss_rate = (miss[1] - miss[0]) / (hi - lo);
+		}
+	}
+	iplc_sim_free();
+	qsort(w, n, sizeof(whatif_t), whatif_cmp);
+
+	printf("What-If Sensitivity \n");
+	if(l1_sets)
+		printf("\t Base is Sets %d, BlockSize %d, Assoc %d, Predict %d, MissDelay %d \n", l1_sets,
+			   blocksize, assoc, predict, memory_latency);
+	else
+		printf("\t Base is Index %d, BlockSize %d, Assoc %d, Predict %d, MissDelay %d \n", index,
+			   blocksize, assoc, predict, memory_latency);
+	printf("\t Base CPI is %f, Cache Miss Rate is %f \n\n", base_cpi, base_miss);
+	printf("\t %-12s %-8s %-10s %-13s Unit \n", "Parameter", "Tried", "CPI/Unit", "MissRate/Unit");
+	for(i = 0; i < n; i++){
+		char tried[32];
+
+		if(!w[i].have[0] && !w[i].have[1]){
+			printf("\t %-12s %-8s %-10s %-13s %s \n", w[i].name, "-", "-", "-", w[i].unit);
+			continue;
+		}
+		if(w[i].have[0] && w[i].have[1])
+			snprintf(tried, sizeof(tried), "%d,%d", w[i].tried[0], w[i].tried[1]);
+		else
+			snprintf(tried, sizeof(tried), "%d", w[i].tried[w[i].have[1]]);
+		printf("\t %-12s %-8s %+f  %+f     %s \n", w[i].name, tried, w[i].cpi,
+			   w[i].miss_rate, w[i].unit);
+	}
+	printf("\n");
+}
+
+/* Trace stripping */
+
+/*
+ * Strip the trace through a direct-mapped filter cache of 1<<index sets
+ * and blocksize words, after Puzak: only the filter's misses are written
+ * to path.  An access that hits a direct-mapped cache re-references the
+ * most recent block of its set, and that block is still the most recent
+ * of its set in any LRU cache with the same blocksize and at least as
+ * many sets, whatever the associativity.  The dropped hits are hits
+ * there too and leave its LRU stacks unchanged, so the stripped stream
+ * gives exact miss counts for all of those caches, taking the accesses
+ * in the order the stream has them.
+ *
+ * That order is the one the filter sees as the cache of a quiet run
+ * under the latencies given, data accesses at MEM after the fetches of
+ * the instructions behind them.  A cache that hits a fetch the filter
+ * missed stalls for less, and a stall shorter than the pipeline lets
+ * those fetches go ahead of the older instructions' data accesses, so
+ * its own run may see a few accesses in another order and its counts
+ * differ a little.
+ *
+ * The file is a miss stream whose header says it was stripped and is
+ * followed by the total number of accesses as two 32-bit words; the
+ * cycle field of each record holds the access's position in the full
+ * stream.
+ */
+void
+iplc_sim_strip(insn_t *trace, long count, int index, int blocksize, char *path)
+{
+	byte hdr[32];
+	long i, n, kept;
+
+	if((miss_stream = fopen(path, "wb")) == NULL){
+		printf("fopen failed for %s file\n", path);
+		exit(-1);
+	}
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, strip_magic, 8);
+	put32(hdr+8, index);
+	put32(hdr+12, blocksize);
+	put32(hdr+16, 1);
+	fwrite(hdr, 1, sizeof(hdr), miss_stream);
+
+	verbose = 0;
+	iplc_sim_init(index, blocksize, 1);
+	strip_stream = 1;
+	for(i = 0; i < count; i++)
+		iplc_sim_issue_instruction(&trace[i]);
+	iplc_sim_drain();
+	strip_stream = 0;
+	n = cache.access;
+	kept = cache.miss;
+
+	put32(hdr+24, (uint) n);
+	put32(hdr+28, (uint) ((unsigned long long) n >> 32));
+	fseek(miss_stream, 0, SEEK_SET);
+	fwrite(hdr, 1, sizeof(hdr), miss_stream);
+	fclose(miss_stream);
+	miss_stream = NULL;
+
+	printf("Trace Stripping \n");
+	printf("\t Filter is Index %d, BlockSize %d, Direct Mapped \n", index, blocksize);
+	printf("\t Number of Accesses is %ld \n", n);
+	printf("\t Number of Accesses Kept is %ld \n", kept);
+	printf("\t Reduction is %f \n\n", n ? (double)n / (double)(kept ? kept : 1) : 0);
+	iplc_sim_free();
+}
+
+/*
+ * Miss counts, from a stripped trace, for every LRU cache with its
+ * blocksize, index within tune_index and at least the filter's, and
+ * associativity within tune_assoc: one stack-distance pass per index.
+ * They are exact for the accesses in the stream's order; see
+ * iplc_sim_strip.  hdr holds the first 24 bytes of the header.
+ */
+void
+iplc_sim_strip_replay(FILE *f, byte *hdr, char *path)
+{
+	byte more[8], rec[13];
+	int findex = get32(hdr+8), blocksize = get32(hdr+12);
+	int offsetbits = (int) rint((log( (double) (blocksize * 4) )/ log(2)));
+	int depth = tune_assoc.hi, index, a;
+	long nrec = 0, cap = 0, i;
+	unsigned long long total;
+	uint *addr = NULL;
+	long *hist = (long*) malloc(sizeof(long) * depth);
+
+	if(fread(more, 1, sizeof(more), f) != sizeof(more)){
+		printf("%s is truncated \n", path);
+		exit(-1);
+	}
+	total = get32(more) | (unsigned long long) get32(more+4) << 32;
+	while(fread(rec, 1, sizeof(rec), f) == sizeof(rec)){
+		if(nrec == cap){
+			cap = cap ? 2*cap : 4096;
+			addr = (uint*) realloc(addr, sizeof(uint) * cap);
+		}
+		addr[nrec++] = get32(rec+1) >> offsetbits;
+	}
+
+	printf("Stripped Trace Replay \n");
+	printf("\t Filter is Index %d, BlockSize %d, Direct Mapped \n", findex, blocksize);
+	printf("\t Number of Accesses is %llu (%ld kept) \n", total, nrec);
+	printf("\t Misses are of the accesses in the order the filter's run saw them \n\n");
+	printf("\t Index\t Assoc\t CacheSize\t Misses\t\t MissRate \n");
+	for(index = findex > tune_index.lo ? findex : tune_index.lo; index <= tune_index.hi; index++){
+		int sets = 1 << index;
+		uint *stack = (uint*) malloc(sizeof(uint) * sets * depth);
+		int *fill = (int*) calloc(sets, sizeof(int));
+		long misses = nrec;
+
+		memset(hist, 0, sizeof(long) * depth);
+		for(i = 0; i < nrec; i++){
+			uint set = addr[i] & (sets-1);
+
+			stack_touch(&stack[set*depth], &fill[set], depth, addr[i] >> index, hist);
+		}
+		for(a = 1; a <= depth; a++){
+			misses -= hist[a-1];
+			if(a < tune_assoc.lo || (a & (a-1)))
+				continue;
+			printf("\t %d\t %d\t %lu\t\t %ld\t\t %f \n", index, a,
+				   iplc_sim_cache_size(1 << index, blocksize, a), misses,
+				   total ? (double)misses / (double)total : 0);
+		}
+		free(stack);
+		free(fill);
+	}
+	printf("\n");
+	free(addr);
+	free(hist);
+}
+
+/* Time-sliced runs */
+
+/*
+ * Run trace through the caches alone: every fetch and data access,
+ * with no pipeline and so no cycles, to leave the caches as the
+ * instructions before a slice would have.
+ */
+void
+iplc_sim_warm(insn_t *trace, long count)
+{
+	long i;
+	int latency;
+
+	for(i = 0; i < count; i++){
+		if(lock_markers)
+			iplc_sim_lock_marker(trace[i].instruction_address);
+		if(!trace[i].nofetch)
+			iplc_sim_trap_address(trace[i].instruction_address, 4, ACCESS_IFETCH,
+								  trace[i].instruction_address, &latency);
+		if(trace[i].itype == LW || trace[i].itype == SW)
+			iplc_sim_trap_address(trace[i].data_address, trace[i].size,
+								  trace[i].itype == LW ? ACCESS_LOAD : ACCESS_STORE,
+								  trace[i].instruction_address, &latency);
+	}
+}
+
+/* Issue trace[*i] up to trace[to], in batches. */
+static void
+slice_issue(insn_t *trace, long *i, long to, long *simple)
+{
+	while(*i < to)
+		*i += iplc_sim_issue_batch(&trace[*i], to - *i, simple);
+}
+
+static void
+slice_diff(sim_result_t *d, sim_result_t *a, sim_result_t *b)
+{
+	d->cycles = b->cycles - a->cycles;
+	d->instructions = b->instructions - a->instructions;
+	d->branches = b->branches - a->branches;
+	d->correct_branches = b->correct_branches - a->correct_branches;
+	d->access = b->access - a->access;
+	d->miss = b->miss - a->miss;
+	d->hit = b->hit - a->hit;
+}
+
+/*
+ * Worker: simulate slice s of trace from a cold start and write what it
+ * measured to fd.  The slice_warmup instructions before it go through the
+ * caches only, except the last MAX_STAGES, which go through the pipeline
+ * too so that it holds what it would have when s->start is issued.
+ * Counting from that issue to the issue of s->end makes the slices' counts
+ * add up to a whole run's.  Past the end, the next slice's overlap is
+ * simulated again from this slice's warm state, for comparison.
+ */
+static void
+slice_worker(insn_t *trace, long count, slice_t *s, long next_overlap,
+			 int index, int blocksize, int assoc, int fd)
+{
+	sim_result_t r0, r1;
+	long warm = s->start < slice_warmup + MAX_STAGES ? s->start : slice_warmup + MAX_STAGES;
+	long i = s->start - warm, simple = 0;
+
+	verbose = 0;
+	iplc_sim_init(index, blocksize, assoc);
+	if(warm > MAX_STAGES){
+		iplc_sim_warm(&trace[i], warm - MAX_STAGES);
+		i += warm - MAX_STAGES;
+	}
+	slice_issue(trace, &i, s->start, &simple);
+	iplc_sim_result_collect(&r0);
+	slice_issue(trace, &i, s->start + s->overlap, &simple);
+	iplc_sim_result_collect(&r1);
+	slice_diff(&s->head, &r0, &r1);
+	slice_issue(trace, &i, s->end, &simple);
+	if(s->end == count)
+		iplc_sim_drain();
+	iplc_sim_result_collect(&r1);
+	slice_diff(&s->body, &r0, &r1);
+	slice_issue(trace, &i, s->end + next_overlap, &simple);
+	iplc_sim_result_collect(&r0);
+	slice_diff(&s->tail, &r1, &r0);
+	if(write(fd, s, sizeof(slice_t)) != sizeof(slice_t))
+		_exit(1);
+	_exit(0);
+}
+
+/* Wait for slice s's worker and take what it measured. */
+static void
+slice_collect(slice_t *s)
+{
+	slice_t got;
+
+	if(read(s->fd, &got, sizeof(got)) != sizeof(got)){
+		printf("Slice worker for %ld..%ld died \n", s->start, s->end);
+		exit(-1);
+	}
+	waitpid(s->pid, NULL, 0);
+	close(s->fd);
+	s->head = got.head;
+	s->body = got.body;
+	s->tail = got.tail;
+}
+
+/*
+ * Cut trace into slice_count contiguous slices and simulate each from a
+ * cold start on its own worker, sweep_workers at a time, then add up
+ * their counts.  Where one slice hands over to the next, the first
+ * sweep_window instructions of the later one are simulated by both; how
+ * far the cold start's counts there are from the warm one's estimates
+ * the error that stitching cold slices together makes.
+ */
+void
+iplc_sim_slices(insn_t *trace, long count, int index, int blocksize, int assoc)
+{
+	slice_t *slices;
+	sim_result_t total;
+	long k, err_cycles = 0, err_miss = 0, overlapped = 0;
+	int running = 0, oldest = 0;
+
+	if(slice_count > count)
+		slice_count = count > 0 ? count : 1;
+	if(sweep_workers <= 0)
+		sweep_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if(sweep_workers <= 0)
+		sweep_workers = 1;
+
+	slices = (slice_t*) calloc(slice_count, sizeof(slice_t));
+	for(k = 0; k < slice_count; k++){
+		slices[k].start = count * k / slice_count;
+		slices[k].end = count * (k+1) / slice_count;
+		slices[k].overlap = slices[k].end - slices[k].start;
+		if(slices[k].overlap > sweep_window)
+			slices[k].overlap = sweep_window;
+	}
+
+	fflush(stdout);
+	for(k = 0; k < slice_count; k++){
+		int fds[2];
+
+		/* slices are about the same length, so the oldest is done first */
+		if(running == sweep_workers){
+			slice_collect(&slices[oldest++]);
+			running--;
+		}
+		if(pipe(fds) < 0){
+			perror("pipe");
+			exit(-1);
+		}
+		if((slices[k].pid = fork()) < 0){
+			perror("fork");
+			exit(-1);
+		}
+		if(slices[k].pid == 0){
+			close(fds[0]);
+			slice_worker(trace, count, &slices[k], k+1 < slice_count ? slices[k+1].overlap : 0,
+						 index, blocksize, assoc, fds[1]);
+		}
+		close(fds[1]);
+		slices[k].fd = fds[0];
+		running++;
+	}
+	while(oldest < slice_count)
+		slice_collect(&slices[oldest++]);
+
+	memset(&total, 0, sizeof(total));
+	for(k = 0; k < slice_count; k++){
+		total.cycles += slices[k].body.cycles;
+		total.instructions += slices[k].body.instructions;
+		total.branches += slices[k].body.branches;
+		total.correct_branches += slices[k].body.correct_branches;
+		total.access += slices[k].body.access;
+		total.miss += slices[k].body.miss;
+		total.hit += slices[k].body.hit;
+		if(k > 0){
+			err_cycles += labs(slices[k-1].tail.cycles - slices[k].head.cycles);
+			err_miss += labs(slices[k-1].tail.miss - slices[k].head.miss);
+			overlapped += slices[k].overlap;
+		}
+	}
+
+	printf("Time-Sliced Performance \n");
+	printf("\t Slices is %ld of about %ld instructions, %d at a time \n", slice_count,
+		   count / slice_count, sweep_workers);
+	printf("\t Warmup is %ld instructions, Overlap is %ld instructions \n\n",
+		   slice_warmup, sweep_window);
+	printf("\t Slice\t Start\t\t CPI\t\t MissRate\t Cycle Error\t Miss Error \n");
+	for(k = 0; k < slice_count; k++){
+		slice_t *s = &slices[k];
+
+		printf("\t %ld\t %ld\t\t %f\t %f\t %ld\t\t %ld \n", k, s->start,
+			   iplc_sim_stat_of("core.cpi", &s->body), iplc_sim_stat_of("l1.miss_rate", &s->body),
+			   k > 0 ? s->head.cycles - slices[k-1].tail.cycles : 0,
+			   k > 0 ? s->head.miss - slices[k-1].tail.miss : 0);
+	}
+	printf("\n");
+	if(STAT_ON(STATS_L1)){
+		printf(" Cache Performance \n");
+		iplc_sim_stat_print(SECTION_CACHE, 0, &total);
+		printf("\n");
+	}
+	if(STAT_ON(STATS_CORE)){
+		printf("Pipeline Performance \n");
+		iplc_sim_stat_print(SECTION_PIPELINE, 0, &total);
+		printf("\n");
+	}
+	if(slice_count > 1){
+		printf("Stitching Error \n");
+		printf("\t Overlapped Instructions is %ld \n", overlapped);
+		printf("\t Cycle Error is %ld (%.3f%% of cycles) \n", err_cycles,
+			   100.0 * err_cycles / total.cycles);
+		printf("\t Miss Error is %ld (%.3f%% of misses) \n\n", err_miss,
+			   total.miss ? 100.0 * err_miss / total.miss : 0);
+	}
+	free(slices);
+}
+
+/* Early-terminating sweeps */
+
+/*
+ * The two-sided normal quantile for the given confidence level.
+ */
+double
+iplc_sim_confidence_z(double confidence)
+{
+	double lo = 0, hi = 10, mid;
+
+	while(hi - lo > 1e-9){
+		mid = (lo + hi) / 2;
+		if(erf(mid / sqrt(2)) < confidence)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Worker: simulate one configuration, reporting each window on fd.
+ */
+static void
+sweep_worker(insn_t *trace, long count, sweep_run_t *r, int fd)
+{
+	sweep_sample_t smp;
+	long i, n, simple = 0, last_cycles = 0, last_insns = 0, last_access = 0, last_miss = 0;
+	long last_branches = 0, last_correct = 0;
+
+	verbose = 0;
+	iplc_sim_init(r->index, r->blocksize, r->assoc);
+	for(i = 0; i < count; i += n){
+		long end = (i / sweep_window + 1) * sweep_window;
+
+		n = iplc_sim_issue_batch(&trace[i], (end < count ? end : count) - i, &simple);
+		if((i+n) % sweep_window != 0 && i+n != count)
+			continue;
+		memset(&smp, 0, sizeof(smp));
+		if(i+n == count){
+			iplc_sim_drain();
+			smp.done = 1;
+		}
+		smp.cycles = pipeline_cycles - last_cycles;
+		smp.instructions = instruction_count - last_insns;
+		smp.access = cache.access - last_access;
+		smp.miss = cache.miss - last_miss;
+		smp.branches = branch_count - last_branches;
+		smp.correct_branches = correct_branch_predictions - last_correct;
+		last_branches = branch_count;
+		last_correct = correct_branch_predictions;
+		last_cycles = pipeline_cycles;
+		last_insns = instruction_count;
+		last_access = cache.access;
+		last_miss = cache.miss;
+		if(write(fd, &smp, sizeof(smp)) != sizeof(smp))
+			_exit(1);
+	}
+	_exit(0);
+}
+
+/*
+ * Is r beaten, with the sweep's confidence, by some other run?
+ * Every run sees the same trace, so compare window by window over the
+ * windows both have finished: a paired test has far less variance than
+ * comparing two running means.
+ */
+static int
+sweep_dominated(sweep_run_t *runs, int nruns, sweep_run_t *r, double z)
+{
+	int i, w, n;
+	double mean, var, d;
+
+	for(i = 0; i < nruns; i++){
+		sweep_run_t *o = &runs[i];
+
+		if(o == r || o->state == PENDING || o->state == PRUNED)
+			continue;
+		n = r->nwin < o->nwin ? r->nwin : o->nwin;
+		if(n < sweep_min_windows)
+			continue;
+		mean = var = 0;
+		for(w = 0; w < n; w++)
+			mean += r->x[w] - o->x[w];
+		mean /= n;
+		for(w = 0; w < n; w++){
+			d = r->x[w] - o->x[w] - mean;
+			var += d * d;
+		}
+		var /= n - 1;
+		if(mean - z * sqrt(var / n) > 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* Statistic name of r over the windows so far. */
+static double
+sweep_stat(sweep_run_t *r, char *name)
+{
+	sim_result_t res;
+
+	memset(&res, 0, sizeof(res));
+	res.cycles = r->cycles;
+	res.instructions = r->instructions;
+	res.access = r->access;
+	res.miss = r->miss;
+	res.hit = r->access - r->miss;
+	return iplc_sim_stat_of(name, &res);
+}
+
+/* Add one window's sample to r. */
+static void
+sweep_record(sweep_run_t *r, sweep_sample_t *smp, int use_cpi)
+{
+	r->cycles += smp->cycles;
+	r->instructions += smp->instructions;
+	r->access += smp->access;
+	r->miss += smp->miss;
+	r->win[r->nwin] = *smp;
+	if(use_cpi)
+		r->x[r->nwin++] = smp->instructions ? (double)smp->cycles / smp->instructions : 0;
+	else
+		r->x[r->nwin++] = smp->access ? (double)smp->miss / smp->access : 0;
+}
+
+static void
+sweep_stop(sweep_run_t *r, enum sweep_state state)
+{
+	if(state == PRUNED)
+		kill(r->pid, SIGKILL);
+	waitpid(r->pid, NULL, 0);
+	close(r->fd);
+	r->state = state;
+}
+
+/*
+ * Simulate every configuration within the tune_* ranges that fits in
+ * budget bits, sweep_workers at a time.  At each window boundary a run
+ * that is statistically beaten by another is stopped, and its worker
+ * slot goes to the next pending configuration.  use_cpi picks CPI as the
+ * metric to minimise, otherwise the miss rate.
+ */
+void
+iplc_sim_sweep(insn_t *trace, long count, unsigned long budget, int use_cpi)
+{
+	sweep_run_t *runs = NULL;
+	struct pollfd *pfd;
+	int *pidx;
+	int nruns = 0, cap = 0, next = 0, running = 0, npruned = 0, ncached = 0;
+	int index, blocksize, assoc, i, best = -1;
+	long maxwin = (count + sweep_window - 1) / sweep_window;
+	long simulated = 0;
+	double z = iplc_sim_confidence_z(sweep_confidence);
+	unsigned long long hash = results_file ? iplc_sim_trace_hash(trace, count) : 0;
+	char key[RESULT_KEY];
+
+	if(sweep_workers <= 0)
+		sweep_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if(sweep_workers <= 0)
+		sweep_workers = 1;
+
+	for(index = tune_index.lo; index <= tune_index.hi; index++)
+		for(blocksize = 1; blocksize <= tune_blocksize.hi; blocksize <<= 1)
+			for(assoc = 1; assoc <= tune_assoc.hi; assoc <<= 1){
+				if(blocksize < tune_blocksize.lo || assoc < tune_assoc.lo ||
+				   iplc_sim_cache_size(1 << index, blocksize, assoc) > budget)
+					continue;
+				if(nruns == cap){
+					cap = cap ? 2*cap : 64;
+					runs = (sweep_run_t*) realloc(runs, sizeof(sweep_run_t) * cap);
+				}
+				memset(&runs[nruns], 0, sizeof(sweep_run_t));
+				runs[nruns].index = index;
+				runs[nruns].blocksize = blocksize;
+				runs[nruns].assoc = assoc;
+				runs[nruns].state = PENDING;
+				runs[nruns].x = (double*) malloc(sizeof(double) * maxwin);
+				runs[nruns].win = (sweep_sample_t*) malloc(sizeof(sweep_sample_t) * maxwin);
+				nruns++;
+			}
+	if(nruns == 0){
+		printf("No configuration fits in %lu bits \n", budget);
+		exit(-1);
+	}
+
+	max_cache_size = budget;
+	fflush(stdout);
+	pfd = (struct pollfd*) malloc(sizeof(struct pollfd) * sweep_workers);
+	pidx = (int*) malloc(sizeof(int) * sweep_workers);
+
+	while(next < nruns || running > 0){
+		int np = 0;
+
+		/* Fill free worker slots with pending configurations */
+		while(running < sweep_workers && next < nruns){
+			sweep_run_t *r = &runs[next++];
+			result_entry_t *e;
+			int fds[2];
+
+			if(results_file){
+				iplc_sim_result_key(key, sizeof(key), hash, count, r->index,
+									r->blocksize, r->assoc, sweep_window);
+				if((e = iplc_sim_results_find(key)) != NULL && e->nwin == maxwin){
+					for(i = 0; i < e->nwin; i++)
+						sweep_record(r, &e->win[i], use_cpi);
+					r->state = DONE;
+					r->cached = 1;
+					ncached++;
+					continue;
+				}
+			}
+
+			if(pipe(fds) < 0){
+				perror("pipe");
+				exit(-1);
+			}
+			if((r->pid = fork()) < 0){
+				perror("fork");
+				exit(-1);
+			}
+			if(r->pid == 0){
+				close(fds[0]);
+				sweep_worker(trace, count, r, fds[1]);
+			}
+			close(fds[1]);
+			r->fd = fds[0];
+			r->state = RUNNING;
+			running++;
+		}
+
+		for(i = 0; i < nruns; i++)
+			if(runs[i].state == RUNNING){
+				pfd[np].fd = runs[i].fd;
+				pfd[np].events = POLLIN;
+				pidx[np++] = i;
+			}
+		if(poll(pfd, np, -1) < 0){
+			perror("poll");
+			exit(-1);
+		}
+
+		for(i = 0; i < np; i++){
+			sweep_run_t *r = &runs[pidx[i]];
+			sweep_sample_t smp;
+			int j;
+
+			if(!(pfd[i].revents & (POLLIN|POLLHUP)) || r->state != RUNNING)
+				continue;
+			if(read(r->fd, &smp, sizeof(smp)) != sizeof(smp)){
+				printf("Sweep worker for %d %d %d died \n", r->index, r->blocksize, r->assoc);
+				exit(-1);
+			}
+			sweep_record(r, &smp, use_cpi);
+			if(smp.done){
+				sweep_stop(r, DONE);
+				running--;
+				if(results_file){
+					sim_result_t res;
+					int w;
+
+					memset(&res, 0, sizeof(res));
+					for(w = 0; w < r->nwin; w++){
+						res.cycles += r->win[w].cycles;
+						res.instructions += r->win[w].instructions;
+						res.branches += r->win[w].branches;
+						res.correct_branches += r->win[w].correct_branches;
+						res.access += r->win[w].access;
+						res.miss += r->win[w].miss;
+					}
+					res.hit = res.access - res.miss;
+					iplc_sim_result_key(key, sizeof(key), hash, count, r->index,
+										r->blocksize, r->assoc, sweep_window);
+					iplc_sim_results_store(key, &res, r->win, r->nwin);
+				}
+			}
+
+			/* New data can sink this run or any run it is compared against */
+			for(j = 0; j < nruns; j++)
+				if(runs[j].state == RUNNING && sweep_dominated(runs, nruns, &runs[j], z)){
+					sweep_stop(&runs[j], PRUNED);
+					running--;
+					npruned++;
+				}
+		}
+	}
+
+	printf("Configuration Sweep \n");
+	printf("\t Metric is %s \n", use_cpi ? "CPI" : "Cache Miss Rate");
+	printf("\t Window is %ld instructions at %.1f%% confidence \n", sweep_window, 100 * sweep_confidence);
+	printf("\t Configurations is %d \n", nruns);
+	printf("\t Stopped Early is %d \n", npruned);
+	printf("\t From Result Cache is %d \n\n", ncached);
+	printf("\t Index\t BlockSize\t Assoc\t Windows\t CPI\t\t MissRate \n");
+	for(i = 0; i < nruns; i++){
+		sweep_run_t *r = &runs[i];
+		double cpi = sweep_stat(r, "core.cpi");
+		double miss_rate = sweep_stat(r, "l1.miss_rate");
+
+		if(!r->cached)
+			simulated += r->nwin;
+		printf("\t %d\t %d\t\t %d\t %d%s\t\t %f\t %f \n", r->index, r->blocksize, r->assoc,
+			   r->nwin, r->state == PRUNED ? " (stopped)" : r->cached ? " (cached)" : "",
+			   cpi, miss_rate);
+		if(r->state == DONE && (best < 0 ||
+		   (use_cpi ? cpi < sweep_stat(&runs[best], "core.cpi")
+					: miss_rate < sweep_stat(&runs[best], "l1.miss_rate"))))
+			best = i;
+	}
+	printf("\n\t Simulated %ld of %ld windows (%.1f%%) \n", simulated, maxwin * nruns,
+		   100.0 * simulated / (maxwin * nruns));
+	if(best >= 0)
+		printf("\t Best is Index %d, BlockSize %d, Assoc %d \n\n",
+			   runs[best].index, runs[best].blocksize, runs[best].assoc);
+
+	for(i = 0; i < nruns; i++){
+		free(runs[i].x);
+		free(runs[i].win);
+	}
+	free(runs);
+	free(pfd);
+	free(pidx);
+}
+
+/* Differential simulation */
+
+/*
+ * Parse a replacement policy name; -1 if unknown.
+ */
+int
+iplc_sim_parse_policy(char *s)
+{
+	if(strcmp(s, "lru") == 0)
+		return REPLACE_LRU;
+	if(strcmp(s, "fifo") == 0)
+		return REPLACE_FIFO;
+	return -1;
+}
+
+/*
+ * Bytes of arena the -d cache B and its per-set counters take, next to a
+ * cache under test with sets sets.
+ */
+size_t
+iplc_sim_diff_bytes(int sets)
+{
+	return iplc_sim_cache_bytes(1 << diff_index, diff_assoc) +
+		iplc_sim_arena_round(sizeof(long) * sets) +
+		iplc_sim_arena_round(sizeof(long) << diff_index);
 }
 
+/*
+ * Shadow the cache under test with a second configuration B that sees
+ * exactly the same accesses.  Divergent accesses are logged to diff_log,
+ * if set, and summarised by iplc_sim_diff_finalize.
+ */
 void
-iplc_sim_process_pipeline_sw(int src_reg, int base_reg, uint data_address)
+iplc_sim_diff_init(arena_t *a)
 {
-	iplc_sim_push_pipeline_stage();
+	if(iplc_sim_cache_size(1 << diff_index, diff_blocksize, diff_assoc) > max_cache_size){
+		printf("Cache too big. Great than MAX SIZE of %lu .... \n", max_cache_size);
+		exit(-1);
+	}
+	iplc_sim_cache_init(&diff_cache, a, 1 << diff_index, diff_blocksize, diff_assoc);
+	diff_cache.policy = diff_policy;
+	diff_a_sets = (long*) iplc_sim_arena_alloc(a, sizeof(long) * cache.nsets);
+	diff_b_sets = (long*) iplc_sim_arena_alloc(a, sizeof(long) << diff_index);
+	diff_a_miss = diff_b_miss = 0;
 
-	pipeline[FETCH].itype = SW;
-	pipeline[FETCH].instruction_address = instruction_address;
-	
-	pipeline[FETCH].stage.sw.src_reg = src_reg;
-	pipeline[FETCH].stage.sw.base_reg = base_reg;
-	pipeline[FETCH].stage.sw.data_address = data_address;
+	/* the PC table grows with the trace, so it lives outside the arena */
+	free(diff_pcs);
+	diff_pcs_size = 1024;
+	diff_pcs_used = 0;
+	diff_pcs = (diff_pc_t*) calloc(diff_pcs_size, sizeof(diff_pc_t));
 }
 
-void
-iplc_sim_process_pipeline_branch(int reg1, int reg2)
+/* Find or add pc in the diff_pcs table. */
+static diff_pc_t *
+diff_pc(uint pc)
 {
-	iplc_sim_push_pipeline_stage();
+	long i;
 
-	pipeline[FETCH].itype = BRANCH;
-	pipeline[FETCH].instruction_address = instruction_address;
-	branch_count++;
+	if(2 * (diff_pcs_used + 1) > diff_pcs_size){
+		diff_pc_t *old = diff_pcs;
+		long n = diff_pcs_size;
 
-	pipeline[FETCH].stage.branch.reg1 = reg1;
-	pipeline[FETCH].stage.branch.reg2 = reg2;
+		diff_pcs_size *= 2;
+		diff_pcs = (diff_pc_t*) calloc(diff_pcs_size, sizeof(diff_pc_t));
+		diff_pcs_used = 0;
+		for(i = 0; i < n; i++)
+			if(old[i].used)
+				*diff_pc(old[i].pc) = old[i];
+		free(old);
+	}
+	for(i = (pc >> 2) & (diff_pcs_size-1); diff_pcs[i].used; i = (i+1) & (diff_pcs_size-1))
+		if(diff_pcs[i].pc == pc)
+			return &diff_pcs[i];
+	diff_pcs[i].used = 1;
+	diff_pcs[i].pc = pc;
+	diff_pcs_used++;
+	return &diff_pcs[i];
 }
 
+/*
+ * The cache under test answered hit for address; see what B says.
+ */
 void
-iplc_sim_process_pipeline_jump(byte *instruction)
+iplc_sim_diff_access(uint address, uint pc, int hit)
 {
-	iplc_sim_push_pipeline_stage();
-
-	/* handle both jump instructions */
-	pipeline[FETCH].itype = (strncmp(instruction, "jal", 3) == 0) ? JAL : JUMP;
-	pipeline[FETCH].instruction_address = instruction_address;
+	int other = iplc_sim_cache_lookup(&diff_cache, address, 0);
+	int aset, bset;
 
-	strcpy(pipeline[FETCH].stage.jump.instruction, instruction);
+	if(hit == other)
+		return;
+	aset = iplc_sim_cache_set(&cache, address);
+	bset = iplc_sim_cache_set(&diff_cache, address);
+	if(!hit){
+		diff_a_miss++;
+		diff_a_sets[aset]++;
+		diff_pc(pc)->a_miss++;
+	}else{
+		diff_b_miss++;
+		diff_b_sets[bset]++;
+		diff_pc(pc)->b_miss++;
+	}
+	if(diff_log)
+		fprintf(diff_log, "%x %x %c %d %d %u\n", pc, address, hit ? 'B' : 'A',
+				aset, bset, pipeline_cycles);
 }
 
-void
-iplc_sim_process_pipeline_syscall()
+static int
+diff_pc_cmp(const void *a, const void *b)
 {
-	iplc_sim_push_pipeline_stage();
+	const diff_pc_t *p = a, *q = b;
+	long np = labs(p->a_miss - p->b_miss), nq = labs(q->a_miss - q->b_miss);
 
-	pipeline[FETCH].itype = SYSCALL;
-	pipeline[FETCH].instruction_address = instruction_address;
+	if(np != nq)
+		return np > nq ? -1 : 1;
+	return p->pc < q->pc ? -1 : p->pc > q->pc;
 }
 
-void
-iplc_sim_process_pipeline_nop()
+/* Print the n sets with the most misses in counts, out of nsets. */
+static void
+diff_top_sets(long *counts, int nsets, int n)
 {
-	iplc_sim_push_pipeline_stage();
-	/*
-	pipeline[FETCH] already set to NOP,
-	since it's zeroed out in iplc_sim_push_pipeline_stage.
-	*/
-}
+	int i, j, best;
+	long *c = (long*) malloc(sizeof(long) * nsets);
 
-/* parse functions  */
+	memcpy(c, counts, sizeof(long) * nsets);
+	for(i = 0; i < n; i++){
+		best = 0;
+		for(j = 1; j < nsets; j++)
+			if(c[j] > c[best])
+				best = j;
+		if(c[best] == 0)
+			break;
+		printf("\t\t %d\t %ld \n", best, c[best]);
+		c[best] = 0;
+	}
+	free(c);
+}
 
 /*
- * Don't touch this function.  It is for parsing the instruction stream.
+ * Summarise which PCs and sets account for the difference in misses
+ * between the cache under test (A) and B.
  */
-uint
-iplc_sim_parse_reg(byte *reg_str)
+void
+iplc_sim_diff_finalize()
 {
-	int i;
-	// turn comma into \n
-	if (reg_str[strlen(reg_str)-1] == ',')
-		reg_str[strlen(reg_str)-1] = '\n';
-	
-	if (reg_str[0] != '$')
-		return atoi(reg_str);
-	else {
-		// copy down over $ byteacter than return atoi
-		for (i = 0; i < strlen(reg_str); i++)
-			reg_str[i] = reg_str[i+1];
-		
-		return atoi(reg_str);
-	}
+	diff_pc_t *pcs = (diff_pc_t*) malloc(sizeof(diff_pc_t) * (diff_pcs_used + 1));
+	long i, n = 0;
+
+	for(i = 0; i < diff_pcs_size; i++)
+		if(diff_pcs[i].used)
+			pcs[n++] = diff_pcs[i];
+	qsort(pcs, n, sizeof(diff_pc_t), diff_pc_cmp);
+
+	printf("Differential Performance \n");
+	printf("\t A is Sets %u, BlockSize %d, Assoc %d, %s \n", cache.nsets, cache.blocksize,
+		   cache.assoc, cache.policy == REPLACE_LRU ? "LRU" : "FIFO");
+	printf("\t B is Sets %u, BlockSize %d, Assoc %d, %s \n", diff_cache.nsets, diff_cache.blocksize,
+		   diff_cache.assoc, diff_cache.policy == REPLACE_LRU ? "LRU" : "FIFO");
+	printf("\t Cache Misses are %ld (A) and %ld (B) \n", cache.miss, diff_cache.miss);
+	printf("\t Divergent Accesses is %ld: %ld missed only in A, %ld missed only in B \n",
+		   diff_a_miss + diff_b_miss, diff_a_miss, diff_b_miss);
+	printf("\t Top PCs (A-only, B-only, net A-B) \n");
+	for(i = 0; i < n && i < 10; i++)
+		printf("\t\t 0x%x\t %ld\t %ld\t %ld \n", pcs[i].pc, pcs[i].a_miss, pcs[i].b_miss,
+			   pcs[i].a_miss - pcs[i].b_miss);
+	printf("\t Top Sets of A (A-only misses) \n");
+	diff_top_sets(diff_a_sets, cache.nsets, 10);
+	printf("\t Top Sets of B (B-only misses) \n");
+	diff_top_sets(diff_b_sets, diff_cache.nsets, 10);
+	printf("\n");
+	free(pcs);
 }
 
+/* Multiprogrammed workloads */
+
 /*
- * Don't touch this function.  It is for parsing the instruction stream.
+ * Interleave nprogs traces on one core, mix_timeslice instructions at a
+ * time, each in its own address space, dropping mix_flush of the cache
+ * at every switch.  Every program is first run alone on the same
+ * configuration, so the slowdown from sharing can be reported.
  */
 void
-iplc_sim_parse_instruction(byte *buffer)
+iplc_sim_mix(insn_t **traces, long *counts, char **names, int nprogs,
+			 int index, int blocksize, int assoc)
 {
-	int instruction_hit = 0;
-	int i=0, j=0;
-	int src_reg=0;
-	int src_reg2=0;
-	int dest_reg=0;
-	byte str_src_reg[16];
-	byte str_src_reg2[16];
-	byte str_dest_reg[16];
-	byte str_constant[16];
-	
-	if (sscanf(buffer, "%x %s", &instruction_address, instruction ) != 2) {
-		printf("Malformed instruction \n");
-		exit(-1);
-	}
-	
-	instruction_hit = iplc_sim_trap_address( instruction_address );
-	
-	// if a MISS, then push current instruction thru pipeline
-	if(!instruction_hit){
-		// need to subtract 1, since the stage is pushed once more for actual instruction processing
-		// also need to allow for a branch miss prediction during the fetch cache miss time -- by
-		// counting cycles this allows for these cycles to overlap and not doubly count.
-		
-		printf("INST MISS:\t Address 0x%x \n", instruction_address);
-		
-		for (i = pipeline_cycles, j = pipeline_cycles; i < j + CACHE_MISS_DELAY - 1; i++)
-			iplc_sim_push_pipeline_stage();
-	}
-	else
-		printf("INST HIT:\t Address 0x%x \n", instruction_address);
-	
-	// Parse the Instruction
-	
-	if (strncmp( instruction, "add", 3 ) == 0 ||
-		strncmp( instruction, "sll", 3 ) == 0 ||
-		strncmp( instruction, "ori", 3 ) == 0) {
-		if (sscanf(buffer, "%x %s %s %s %s",
-				   &instruction_address,
-				   instruction,
-				   str_dest_reg,
-				   str_src_reg,
-				   str_src_reg2 ) != 5) {
-			printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
-				   instruction, instruction_address);
-			exit(-1);
-		}
-		
-		dest_reg = iplc_sim_parse_reg(str_dest_reg);
-		src_reg = iplc_sim_parse_reg(str_src_reg);
-		src_reg2 = iplc_sim_parse_reg(str_src_reg2);
-		
-		iplc_sim_process_pipeline_rtype(instruction, dest_reg, src_reg, src_reg2);
-	}
-	
-	else if (strncmp( instruction, "lui", 3 ) == 0) {
-		if (sscanf(buffer, "%x %s %s %s",
-				   &instruction_address,
-				   instruction,
-				   str_dest_reg,
-				   str_constant ) != 4 ) {
-			printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
-				   instruction, instruction_address );
-			exit(-1);
-		}
-		
-		dest_reg = iplc_sim_parse_reg(str_dest_reg);
-		src_reg = -1;
-		src_reg2 = -1;
-		iplc_sim_process_pipeline_rtype(instruction, dest_reg, src_reg, src_reg2);
+	sim_result_t *alone = (sim_result_t*) calloc(nprogs, sizeof(sim_result_t));
+	sim_result_t *mixed = (sim_result_t*) calloc(nprogs, sizeof(sim_result_t));
+	long *pos = (long*) calloc(nprogs, sizeof(long));
+	long switches = 0, k;
+	int p, level, left = nprogs, last = -1, chatter = verbose;
+
+	verbose = 0;
+	for(p = 0; p < nprogs; p++){
+		iplc_sim_init(index, blocksize, assoc);
+		iplc_sim_run(traces[p], counts[p]);
+		iplc_sim_result_collect(&alone[p]);
 	}
-	
-	else if (strncmp( instruction, "lw", 2 ) == 0 ||
-			 strncmp( instruction, "sw", 2 ) == 0  ) {
-		if ( sscanf( buffer, "%x %s %s %s %x",
-					&instruction_address,
-					instruction,
-					reg1,
-					offsetwithreg,
-					&data_address ) != 5) {
-			printf("Bad instruction: %s at address %x \n", instruction, instruction_address);
-			exit(-1);
-		}
-		
-		if (strncmp(instruction, "lw", 2 ) == 0) {
-			
-			dest_reg = iplc_sim_parse_reg(reg1);
-			
-			// don't need to worry about base regs -- just insert -1 values
-			iplc_sim_process_pipeline_lw(dest_reg, -1, data_address);
-		}
-		if (strncmp( instruction, "sw", 2 ) == 0) {
-			src_reg = iplc_sim_parse_reg(reg1);
-			
-			// don't need to worry about base regs -- just insert -1 values
-			iplc_sim_process_pipeline_sw( src_reg, -1, data_address);
+	verbose = chatter;
+
+	iplc_sim_init(index, blocksize, assoc);
+	while(left > 0){
+		for(p = 0; p < nprogs; p++){
+			if(pos[p] == counts[p])
+				continue;
+			if(last >= 0 && last != p){
+				switches++;
+				if(mix_flush > 0){
+					iplc_sim_cache_flush(&cache, mix_flush);
+					if(diff_cache.sets)
+						iplc_sim_cache_flush(&diff_cache, mix_flush);
+				}
+			}
+			cache.asid = diff_cache.asid = p;
+			for(level = 0; level < nlower; level++)
+				lower[level].asid = p;
+			last = p;
+			for(k = 0; k < mix_timeslice && pos[p] < counts[p]; k++){
+				uint c0 = pipeline_cycles;
+				long a0 = cache.access, m0 = cache.miss;
+				insn_t *insn = &traces[p][pos[p]++];
+
+				iplc_sim_issue_instruction(insn);
+				if (dump_pipeline && verbose)
+					iplc_sim_dump_pipeline();
+				mixed[p].cycles += pipeline_cycles - c0;
+				mixed[p].access += cache.access - a0;
+				mixed[p].miss += cache.miss - m0;
+				if(insn->itype != NOP)
+					mixed[p].instructions++;
+			}
+			if(pos[p] == counts[p])
+				left--;
 		}
 	}
-	else if (strncmp( instruction, "beq", 3 ) == 0) {
-		// don't need to worry about getting regs -- just insert -1 values
-		iplc_sim_process_pipeline_branch(-1, -1);
-	}
-	else if (strncmp( instruction, "jal", 3 ) == 0 ||
-			 strncmp( instruction, "jr", 2 ) == 0 ||
-			 strncmp( instruction, "j", 1 ) == 0 ) {
-		iplc_sim_process_pipeline_jump( instruction );
-	}
-	else if (strncmp( instruction, "jal", 3 ) == 0 ||
-			 strncmp( instruction, "jr", 2 ) == 0 ||
-			 strncmp( instruction, "j", 1 ) == 0 ) {
-		/*
-		 * Note: no need to worry about forwarding on the jump register
-		 * we'll let that one go.
-		 */
-		iplc_sim_process_pipeline_jump(instruction);
-	}
-	else if ( strncmp( instruction, "syscall", 7 ) == 0) {
-		iplc_sim_process_pipeline_syscall( );
-	}
-	else if ( strncmp( instruction, "nop", 3 ) == 0) {
-		iplc_sim_process_pipeline_nop( );
+	/* the last program to run owns the drain */
+	{
+		uint c0 = pipeline_cycles;
+
+		iplc_sim_drain();
+		if(last >= 0)
+			mixed[last].cycles += pipeline_cycles - c0;
 	}
-	else {
-		printf("Do not know how to process instruction: %s at address %x \n",
-			   instruction, instruction_address );
-		exit(-1);
+
+	iplc_sim_finalize();
+	printf("Multiprogrammed Performance \n");
+	printf("\t Timeslice is %ld instructions, %.1f%% of the cache dropped per switch \n",
+		   mix_timeslice, 100 * mix_flush);
+	printf("\t Context Switches is %ld \n", switches);
+	printf("\t Program\t CPI Alone\t CPI Mixed\t Slowdown\t Misses Alone\t Misses Mixed \n");
+	for(p = 0; p < nprogs; p++){
+		double alone_cpi = iplc_sim_stat_of("core.cpi", &alone[p]);
+		double cpi = iplc_sim_stat_of("core.cpi", &mixed[p]);
+
+		printf("\t %s\t %f\t %f\t %f\t %ld\t\t %ld \n", names[p], alone_cpi, cpi,
+			   cpi / alone_cpi, (long) iplc_sim_stat_of("l1.miss", &alone[p]),
+			   (long) iplc_sim_stat_of("l1.miss", &mixed[p]));
 	}
+	printf("\n");
+
+	free(alone);
+	free(mixed);
+	free(pos);
 }
 
 /* MAIN Function  */
 
+void
+usage()
+{
+	fprintf(stderr, "usage: iplc-sim [-p predict] [-t budget] [-i index] [-b blocksize] [-a assoc]\n"
+			"\t[-s cpi|miss [-j workers] [-w window] [-c confidence]]\n"
+			"\t[-r lru|fifo] [-d index,blocksize,assoc[,lru|fifo] [-D difflog]]\n"
+			"\t[-m timeslice [-f flush]] [-R resultcache]\n"
+			"\t[-S sets] [-l index|setss,blocksize,assoc,latency ...] [-L memlatency]\n"
+			"\t[-o missstream | -x missstream] [-K base,size[,lockpc[,unlockpc]] ...]\n"
+			"\t[-C beatwords[,beatcycles[,whole|early|cwf]]] [-A base,size,latency[,scratch|uncached] ...]\n"
+			"\t[-F index,blocksize -o strippedtrace]\n"
+			"\t[-P sequential|random|binhop|color[,pagesize] [-V]]\n"
+			"\t[-T iplc|din|champsim|raw32|raw64] [-H] [-M statspage]\n"
+			"\t[-e timeline.json [-E first[,count]]]\n"
+			"\t[-g core,l1,lower,pages,latency] [-J stats.json]\n"
+			"\t[-k slices[,warmup] [-j workers] [-w overlap]] [-W]\n"
+			"\t[-B, with -t, -s, -k or -W, and without -C or marked -K]\n"
+			"\t[-O outcomes | -Y outcomes [predict=p,penalty=n,missdelay=n,l2=n,... ...]]\n"
+			"\t[tracefile ...]\n");
+	exit(-1);
+}
+
 int
-main()
+main(int argc, char **argv)
 {
-	byte trace_file_name[1024];
-	FILE *trace_file = NULL;
-	byte buffer[80];
+	char trace_file_name[1024];
+	trace_in_t *trace_file = NULL;
+	insn_t insn;
 	int index = 10;
 	int blocksize = 1;
 	int assoc = 1;
+	int predict_set = 0;
+	unsigned long budget = 0;
+	insn_t *trace = NULL;
+	long count = 0;
+	int sweep = 0, use_cpi = 1, what_if = 0;
+	int diff = 0;
+	char diff_policy_name[16];
+	char level_index[16];
+	char page_policy_name[16];
+	char *results_path = NULL;
+	char *miss_stream_path = NULL;
+	char *replay_path = NULL;
+	char *outcomes_path = NULL, *outcomes_replay = NULL;
+	char *stats_path = NULL;
+	char *timeline_path = NULL;
+	int strip_index = -1, strip_blocksize = 0;
+	int c, i;
 
-	printf("Please enter the tracefile: ");
-	scanf("%s", trace_file_name);
-	
-	trace_file = fopen(trace_file_name, "r");
+	while((c = getopt(argc, argv, "p:t:i:b:a:s:j:w:c:r:d:D:m:f:R:l:L:o:x:F:P:VT:Bk:HM:e:E:g:J:C:A:S:K:WO:Y:")) != -1){
+		switch(c){
+		case 'p':
+			branch_predict_taken = atoi(optarg);
+			predict_set = 1;
+			break;
+		case 't':
+			budget = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			if(!iplc_sim_parse_range(optarg, &tune_index))
+				usage();
+			break;
+		case 'b':
+			if(!iplc_sim_parse_range(optarg, &tune_blocksize))
+				usage();
+			break;
+		case 'a':
+			if(!iplc_sim_parse_range(optarg, &tune_assoc))
+				usage();
+			break;
+		case 's':
+			sweep = 1;
+			if(strcmp(optarg, "miss") == 0)
+				use_cpi = 0;
+			else if(strcmp(optarg, "cpi") != 0)
+				usage();
+			break;
+		case 'j':
+			sweep_workers = atoi(optarg);
+			break;
+		case 'w':
+			sweep_window = atol(optarg);
+			if(sweep_window <= 0)
+				usage();
+			break;
+		case 'c':
+			sweep_confidence = atof(optarg);
+			if(sweep_confidence <= 0 || sweep_confidence >= 1)
+				usage();
+			break;
+		case 'r':
+			if((cache_policy = iplc_sim_parse_policy(optarg)) < 0)
+				usage();
+			break;
+		case 'd':
+			diff = sscanf(optarg, "%d,%d,%d,%15s", &diff_index, &diff_blocksize,
+						  &diff_assoc, diff_policy_name);
+			if(diff < 3 || diff_assoc <= 0)
+				usage();
+			if(diff == 4 && (diff_policy = iplc_sim_parse_policy(diff_policy_name)) < 0)
+				usage();
+			break;
+		case 'm':
+			mix_timeslice = atol(optarg);
+			if(mix_timeslice <= 0)
+				usage();
+			break;
+		case 'f':
+			mix_flush = atof(optarg);
+			if(mix_flush < 0 || mix_flush > 1)
+				usage();
+			break;
+		case 'R':
+			results_path = optarg;
+			break;
+		case 'l':
+			if(nlower == MAX_LEVELS-1)
+				usage();
+			if(sscanf(optarg, "%15[^,],%d,%d,%d", level_index, &lower_config[nlower].blocksize,
+					  &lower_config[nlower].assoc, &lower_config[nlower].latency) != 4 ||
+			   iplc_sim_parse_sets(level_index, &lower_config[nlower].sets) < 0 ||
+			   lower_config[nlower].assoc <= 0 || lower_config[nlower].blocksize <= 0)
+				usage();
+			for(lower_config[nlower].index = 0;
+				1 << lower_config[nlower].index < lower_config[nlower].sets; lower_config[nlower].index++)
+				;
+			nlower++;
+			break;
+		case 'W':
+			what_if = 1;
+			break;
+		case 'K':
+			if(iplc_sim_parse_lock(optarg) < 0)
+				usage();
+			break;
+		case 'S':
+			if((l1_sets = atoi(optarg)) <= 0 || l1_sets > 1 << 24)
+				usage();
+			break;
+		case 'L':
+			if((memory_latency = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'o':
+			miss_stream_path = optarg;
+			break;
+		case 'x':
+			replay_path = optarg;
+			break;
+		case 'O':
+			outcomes_path = optarg;
+			break;
+		case 'Y':
+			outcomes_replay = optarg;
+			break;
+		case 'P':
+			if(sscanf(optarg, "%15[^,],%u", page_policy_name, &page_size) < 1 ||
+			   (page_policy = iplc_sim_parse_page_policy(page_policy_name)) < 0 ||
+			   page_size < PAGE_MIN || (page_size & (page_size-1)))
+				usage();
+			break;
+		case 'V':
+			page_virtual_l1 = 1;
+			break;
+		case 'B':
+			block_memoize = 1;
+			break;
+		case 'H':
+			show_latency = 1;
+			break;
+		case 'M':
+			stats_path = optarg;
+			break;
+		case 'e':
+			timeline_path = optarg;
+			break;
+		case 'g':
+			if((stat_enabled = iplc_sim_stat_parse_groups(optarg)) == (uint)-1)
+				usage();
+			break;
+		case 'J':
+			stat_json = optarg;
+			break;
+		case 'C':
+			if(iplc_sim_parse_fill(optarg) < 0)
+				usage();
+			break;
+		case 'A':
+			if(iplc_sim_parse_region(optarg) < 0)
+				usage();
+			break;
+		case 'E':
+			if(sscanf(optarg, "%ld,%ld", &timeline_first, &timeline_count) < 1 ||
+			   timeline_first < 0 || timeline_count <= 0)
+				usage();
+			break;
+		case 'k':
+			if(sscanf(optarg, "%ld,%ld", &slice_count, &slice_warmup) < 1 ||
+			   slice_count <= 0 || slice_warmup < 0)
+				usage();
+			break;
+		case 'T':
+			if((trace_format = iplc_sim_trace_reader(optarg)) == NULL)
+				usage();
+			break;
+		case 'F':
+			if(sscanf(optarg, "%d,%d", &strip_index, &strip_blocksize) != 2 || strip_blocksize <= 0)
+				usage();
+			break;
+		case 'D':
+			if((diff_log = fopen(optarg, "w")) == NULL){
+				printf("fopen failed for %s file\n", optarg);
+				exit(-1);
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+
+	/* sweeps and tuning pick their own indices */
+	if(l1_sets && (sweep || budget))
+		usage();
+	/* what tuning estimates from LRU stacks alone */
+	if(budget && (cache_policy != REPLACE_LRU || nregions || nlocks || beat_words))
+		usage();
+	/* -B remembers batches, which the plain run and -m never issue and -C and markers stop */
+	if(block_memoize){
+		if(beat_words || !(budget || sweep || slice_count || what_if))
+			usage();
+		for(i = 0; i < nlocks; i++)
+			if(locks[i].lock_pc)
+				usage();
+	}
+	if(outcomes_replay){
+		iplc_sim_outcomes_replay(outcomes_replay, argv + optind, argc - optind);
+		return 0;
+	}
+	/* a recorded stream is of the plain run, with latencies that do not depend on time */
+	if(outcomes_path && (beat_words || slice_count || mix_timeslice || what_if))
+		usage();
+
+	if(replay_path){
+		iplc_sim_miss_stream_replay(replay_path);
+		return 0;
+	}
+
+	if(optind < argc){
+		strncpy(trace_file_name, argv[optind], sizeof(trace_file_name)-1);
+		trace_file_name[sizeof(trace_file_name)-1] = '\0';
+	}else{
+		printf("Please enter the tracefile: ");
+		scanf("%s", trace_file_name);
+	}
 	
-	if(!trace_file){
-		printf("fopen failed for %s file\n", trace_file_name);
-		exit(-1);
+	trace_file = iplc_sim_trace_open(trace_file_name);
+
+	if(strip_index >= 0){
+		/* locks, translation and odd set counts break the inclusion stripping relies on */
+		if(miss_stream_path == NULL || nlocks || page_policy != PAGE_NONE || l1_sets)
+			usage();
+		trace = iplc_sim_load_trace(trace_file, &count);
+		iplc_sim_trace_close(trace_file);
+		iplc_sim_strip(trace, count, strip_index, strip_blocksize, miss_stream_path);
+		free(trace);
+		return 0;
+	}
+
+	/* opened after the options, since the key depends on all of them */
+	if(results_path)
+		iplc_sim_results_open(results_path);
+
+	if(sweep){
+		trace = iplc_sim_load_trace(trace_file, &count);
+		iplc_sim_trace_close(trace_file);
+		iplc_sim_sweep(trace, count, budget ? budget : max_cache_size, use_cpi);
+		free(trace);
+		return 0;
+	}
+	if(budget){
+		trace = iplc_sim_load_trace(trace_file, &count);
+		iplc_sim_trace_close(trace_file);
+		iplc_sim_tune(trace, count, budget);
+		free(trace);
+		return 0;
 	}
 	
 	printf("Enter Cache Size (index), Blocksize and Level of Assoc \n");
 	scanf( "%d %d %d", &index, &blocksize, &assoc );
 	
-	printf("Enter Branch Prediction: 0 (NOT taken), 1 (TAKEN): ");
-	scanf("%d", &branch_predict_taken );
+	if(!predict_set){
+		printf("Enter Branch Prediction: 0 (NOT taken), 1 (TAKEN): ");
+		scanf("%d", &branch_predict_taken );
+	}
+
+	if(what_if){
+		trace = iplc_sim_load_trace(trace_file, &count);
+		iplc_sim_trace_close(trace_file);
+		iplc_sim_whatif(trace, count, index, blocksize, assoc);
+		free(trace);
+		return 0;
+	}
+
+	if(slice_count){
+		trace = iplc_sim_load_trace(trace_file, &count);
+		iplc_sim_trace_close(trace_file);
+		iplc_sim_slices(trace, count, index, blocksize, assoc);
+		free(trace);
+		return 0;
+	}
+
+	if(mix_timeslice){
+		char *prompted[1];
+		char **names = argv + optind;
+		int nprogs = argc - optind, p;
+		insn_t **traces;
+		long *counts;
+
+		if(nprogs == 0){
+			prompted[0] = trace_file_name;
+			names = prompted;
+			nprogs = 1;
+		}
+		traces = (insn_t**) malloc(sizeof(insn_t*) * nprogs);
+		counts = (long*) malloc(sizeof(long) * nprogs);
+		for(p = 0; p < nprogs; p++){
+			if(p > 0)
+				trace_file = iplc_sim_trace_open(names[p]);
+			traces[p] = iplc_sim_load_trace(trace_file, &counts[p]);
+			iplc_sim_trace_close(trace_file);
+		}
+		iplc_sim_mix(traces, counts, names, nprogs, index, blocksize, assoc);
+		return 0;
+	}
 	
 	iplc_sim_init(index, blocksize, assoc);
+	if(miss_stream_path)
+		iplc_sim_miss_stream_open(miss_stream_path);
+	if(outcomes_path)
+		iplc_sim_outcomes_open(outcomes_path);
+	if(stats_path)
+		iplc_sim_stats_open(stats_path);
+	if(timeline_path)
+		iplc_sim_timeline_open(timeline_path, timeline_first, timeline_count);
 	
-	while(fgets(buffer, 80, trace_file) != NULL){
-		iplc_sim_parse_instruction(buffer);
+	while(iplc_sim_trace_read(trace_file, &insn)){
+		iplc_sim_issue_instruction(&insn);
 		if (dump_pipeline)
 			iplc_sim_dump_pipeline();
+		stats_tick(1);
 	}
+	iplc_sim_trace_close(trace_file);
 	
 	iplc_sim_finalize();
+	if(miss_stream)
+		fclose(miss_stream);
+	if(outcomes)
+		iplc_sim_outcomes_close();
 	return 0;
 }
 
-
 /*
 int
 main(int argc, char **argv)
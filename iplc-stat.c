@@ -0,0 +1,186 @@
+/*
+ * iplc-stat: watch a running iplc-sim's counters.
+ *
+ * Maps the statistics page iplc-sim -M publishes, read-only, and prints a
+ * line of its counters every interval seconds until the run is done or
+ * the simulator is gone.  Reading takes no lock the simulator waits on;
+ * see iplc-stats.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "iplc-stats.h"
+
+void
+usage()
+{
+	fprintf(stderr, "usage: iplc-stat [-i interval] [-1] statspage\n");
+	exit(-1);
+}
+
+/* A consistent copy of the page at p. */
+void
+iplc_stat_read(iplc_stats_t *p, iplc_stats_t *copy)
+{
+	uint32_t seq;
+
+	for(;;){
+		seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+		if(seq & 1){
+			usleep(100);
+			continue;
+		}
+		memcpy(copy, p, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&p->seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
+
+/* Whether s has an entry called name; its value in *v if so. */
+int
+iplc_stat_find(iplc_stats_t *s, char *name, int64_t *v)
+{
+	int i;
+
+	for(i = 0; i < s->nentries && i < IPLC_STATS_ENTRIES; i++)
+		if(strncmp(s->entry[i].name, name, IPLC_STATS_NAME) == 0){
+			*v = s->entry[i].value;
+			return 1;
+		}
+	return 0;
+}
+
+/* The value of the entry called name in s, 0 if there is none. */
+int64_t
+iplc_stat_get(iplc_stats_t *s, char *name)
+{
+	int64_t v = 0;
+
+	iplc_stat_find(s, name, &v);
+	return v;
+}
+
+/* The names of the access and miss counters of level level, the cache first. */
+void
+iplc_stat_level(int level, char *access, char *miss, int n)
+{
+	if(level == 0){
+		snprintf(access, n, "l1.access");
+		snprintf(miss, n, "l1.miss");
+	}else{
+		snprintf(access, n, "lower.access[%d]", level-1);
+		snprintf(miss, n, "lower.miss[%d]", level-1);
+	}
+}
+
+/* Levels in s: the cache and each below it that has counters. */
+int
+iplc_stat_levels(iplc_stats_t *s)
+{
+	char access[IPLC_STATS_NAME], miss[IPLC_STATS_NAME];
+	int64_t v;
+	int level = 1;
+
+	for(;;){
+		iplc_stat_level(level, access, miss, sizeof(access));
+		if(!iplc_stat_find(s, access, &v))
+			return level;
+		level++;
+	}
+}
+
+void
+iplc_stat_print(iplc_stats_t *s, iplc_stats_t *last, double interval)
+{
+	char access[IPLC_STATS_NAME], miss[IPLC_STATS_NAME];
+	int64_t instructions = iplc_stat_get(s, "core.instructions");
+	int64_t cycles = iplc_stat_get(s, "core.cycles");
+	int level, nlevels = iplc_stat_levels(s);
+
+	printf("%12lld %12lld %9.6f", (long long)instructions, (long long)cycles,
+		   instructions ? (double)cycles / instructions : 0);
+	for(level = 0; level < nlevels; level++){
+		iplc_stat_level(level, access, miss, sizeof(access));
+		printf(" %9.6f", iplc_stat_get(s, access) ?
+			   (double)iplc_stat_get(s, miss) / iplc_stat_get(s, access) : 0);
+	}
+	if(last)
+		printf(" %12.0f", (instructions - iplc_stat_get(last, "core.instructions")) / interval);
+	printf("%s\n", s->done ? " done" : "");
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	iplc_stats_t *page, now, last;
+	double interval = 1;
+	int once = 0, fd, c, level, nlevels, have_last = 0;
+
+	while((c = getopt(argc, argv, "i:1")) != -1){
+		switch(c){
+		case 'i':
+			interval = atof(optarg);
+			if(interval <= 0)
+				usage();
+			break;
+		case '1':
+			once = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if(optind != argc - 1)
+		usage();
+
+	if((fd = open(argv[optind], O_RDONLY)) < 0){
+		printf("open failed for %s file\n", argv[optind]);
+		exit(-1);
+	}
+	page = (iplc_stats_t*) mmap(NULL, sizeof(iplc_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(page == MAP_FAILED){
+		perror("mmap");
+		exit(-1);
+	}
+	if(memcmp(page->magic, IPLC_STATS_MAGIC, sizeof(page->magic)) != 0 ||
+	   page->version != IPLC_STATS_VERSION){
+		printf("%s is not a version %d statistics page\n", argv[optind], IPLC_STATS_VERSION);
+		exit(-1);
+	}
+
+	iplc_stat_read(page, &now);
+	printf("iplc-sim %d: Sets %lld, BlockSize %lld, Assoc %lld\n", now.pid,
+		   (long long)iplc_stat_get(&now, "l1.sets"), (long long)iplc_stat_get(&now, "l1.blocksize"),
+		   (long long)iplc_stat_get(&now, "l1.assoc"));
+	printf("%12s %12s %9s", "Instructions", "Cycles", "CPI");
+	nlevels = iplc_stat_levels(&now);
+	for(level = 0; level < nlevels; level++){
+		char name[24];
+
+		snprintf(name, sizeof(name), "L%d Miss", level+1);
+		printf(" %9s", name);
+	}
+	printf(once ? "\n" : " %12s\n", "Insns/s");
+	for(;;){
+		iplc_stat_print(&now, have_last ? &last : NULL, interval);
+		if(once || now.done)
+			break;
+		if(kill(now.pid, 0) < 0 && errno == ESRCH){
+			printf("iplc-sim %d is gone\n", now.pid);
+			break;
+		}
+		last = now;
+		have_last = 1;
+		usleep((useconds_t)(interval * 1e6));
+		iplc_stat_read(page, &now);
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * The live statistics page iplc-sim -M publishes and iplc-stat reads.
+ *
+ * The page is one iplc_stats_t at the start of a file both map shared.
+ * It holds a table of the simulator's statistics by registry name, a
+ * vector's elements as name[i].  The names are written once, before the
+ * simulation starts, and never change; only the values do.  They are
+ * guarded by a sequence lock: the simulator makes seq odd, writes the
+ * values, then makes seq even again.  A reader copies the page and keeps
+ * the copy only if seq was even and unchanged across the copy, so reading
+ * never makes the simulator wait.
+ */
+#include <stdint.h>
+
+#define IPLC_STATS_MAGIC "IPLCSTAT"
+
+enum {
+	IPLC_STATS_VERSION = 2, // bump whenever the layout below changes
+	IPLC_STATS_ENTRIES = 96, // more than the registry ever has enabled
+	IPLC_STATS_NAME = 32     // bytes of a name, with its NUL
+};
+
+typedef struct iplc_stats_entry{
+	char name[IPLC_STATS_NAME];
+	int64_t value;
+} iplc_stats_entry_t;
+
+typedef struct iplc_stats{
+	char magic[8];
+	uint32_t version;
+	uint32_t seq;            /* odd while the values are being written */
+	int32_t pid;             /* of the simulator */
+	int32_t done;            /* the run has finished; these are final */
+	int32_t nentries;        /* of entry[] in use */
+	int32_t pad;
+	iplc_stats_entry_t entry[IPLC_STATS_ENTRIES];
+} iplc_stats_t;